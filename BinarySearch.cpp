@@ -3,43 +3,87 @@
 #include <vector>
 #include <set>
 #include <list>
+#include <utility>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include "PerfCounters.h"
+#include "BinarySearch.h"
 
-// Return iterator pointing to the location where target was found. If target was not found, the location of where it would be is returned.
+// Return iterator to the first element that is not less than target, first position target could be inserted at
 template <typename Iter, typename T>
-Iter binary_search_position(Iter first, Iter last, const T target)
+constexpr Iter lower_bound_position(Iter first, Iter last, const T target)
 {
-	// Container has 0 or 1 elements
-	if(first == last || std::next(first) == last)
+	auto count = std::distance(first, last);
+	while(count > 0)
 	{
-		return first;
-	}
-	
-	// Move iterator to point to last element
-	last--;
-		
-	while(first != last)
-	{
-		// Calculate the mid point between first and last
-		auto mid = first;
-		std::advance(mid, std::distance(first, std::next(last)) / 2);// Calling next on last is to cause rounding up in the case the distance is odd
-		if(*mid > target)
+		const auto half = count / 2;
+		auto mid = std::next(first, half);
+		if(*mid < target)
 		{
-			last = std::prev(mid);
+			first = std::next(mid);
+			count -= half + 1;
 		}
 		else
 		{
-			first = mid;
+			count = half;
 		}
 	}
-	if(*last == target)
+	return first;
+}
+
+// Return iterator to the first element greater than target, last position target could be inserted at
+template <typename Iter, typename T>
+constexpr Iter upper_bound_position(Iter first, Iter last, const T target)
+{
+	auto count = std::distance(first, last);
+	while(count > 0)
 	{
-		return last;
+		const auto half = count / 2;
+		auto mid = std::next(first, half);
+		if(target < *mid)
+		{
+			count = half;
+		}
+		else
+		{
+			first = std::next(mid);
+			count -= half + 1;
+		}
 	}
-	else
+	return first;
+}
+
+// Return the range of elements equal to target as [lower bound, upper bound).
+// Both bounds share one descent while the midpoint is on the same side of target for both of them,
+// the search only splits in two once it lands on an element equal to target.
+template <typename Iter, typename T>
+constexpr std::pair<Iter, Iter> equal_range_position(Iter first, Iter last, const T target)
+{
+	auto count = std::distance(first, last);
+	while(count > 0)
 	{
-		// Target not found, return iterator to position where target would go
-		return std::next(last);
+		const auto half = count / 2;
+		auto mid = std::next(first, half);
+		if(*mid < target)
+		{
+			first = std::next(mid);
+			count -= half + 1;
+		}
+		else if(target < *mid)
+		{
+			count = half;
+		}
+		else
+		{
+			// Lower bound is in [first, mid], upper bound in (mid, first + count]
+			auto lower = lower_bound_position(first, mid, target);
+			auto upper = upper_bound_position(std::next(mid), std::next(first, count), target);
+			return std::make_pair(lower, upper);
+		}
 	}
+	return std::make_pair(first, first);
 }
 
 // Test 1: Odd length vector
@@ -207,6 +251,138 @@ void test_list_int()
 	}
 }
 
+// Test 9: Bounds of duplicated values
+void test_bounds_duplicates()
+{
+	std::vector<int> vec = {1, 2, 2, 2, 3, 5, 5, 8};
+	bool passed = true;
+	for(int target = 0; target <= 9; target++)
+	{
+		const auto range = equal_range_position(vec.begin(), vec.end(), target);
+		const auto expected = std::equal_range(vec.begin(), vec.end(), target);
+		passed = passed && range == expected;
+		passed = passed && lower_bound_position(vec.begin(), vec.end(), target) == expected.first;
+		passed = passed && upper_bound_position(vec.begin(), vec.end(), target) == expected.second;
+	}
+	if(passed)
+	{
+		std::cout << "Test 9 (bounds of duplicated values): Passed" << std::endl;
+	}
+	else
+	{
+		std::cout << "Test 9 (bounds of duplicated values): Failed" << std::endl;
+	}
+}
+
+// Test 10: Bounds on empty, single element and list ranges
+void test_bounds_edge_cases()
+{
+	std::vector<int> empty_vec;
+	const auto empty_range = equal_range_position(empty_vec.begin(), empty_vec.end(), 5);
+	std::vector<int> single = {5};
+	const auto single_range = equal_range_position(single.begin(), single.end(), 5);
+	std::list<int> testList = {-10, 10, 20, 20, 30, 30, 30, 40};
+	const auto list_range = equal_range_position(testList.begin(), testList.end(), 30);
+	if(empty_range.first == empty_vec.end() && empty_range.second == empty_vec.end()
+		&& single_range.first == single.begin() && single_range.second == single.end()
+		&& std::distance(testList.begin(), list_range.first) == 4 && list_range.second == std::prev(testList.end()))
+	{
+		std::cout << "Test 10 (bounds on edge cases): Passed" << std::endl;
+	}
+	else
+	{
+		std::cout << "Test 10 (bounds on edge cases): Failed" << std::endl;
+	}
+}
+
+// Test 11: Range queries on heavily duplicated keys, shared descent against binary_search_position plus scans
+void test_bounds_speed()
+{
+	std::vector<int> vec(10000000);
+	for(std::size_t i = 0; i < vec.size(); i++)
+	{
+		vec[i] = static_cast<int>(i / 1024); // Every key appears 1024 times
+	}
+	std::mt19937 gen(11);
+	std::vector<int> targets(1000000);
+	for(auto &t : targets)
+	{
+		t = static_cast<int>(gen() % (vec.size() / 1024));
+	}
+	
+	PerfCounters counters;
+	long scanned = 0;
+	counters.start();
+	auto start = std::chrono::steady_clock::now();
+	for(const auto target : targets)
+	{
+		// binary_search_position finds the last match, walk back to the first one
+		auto upper = std::next(binary_search_position(vec.begin(), vec.end(), target));
+		auto lower = std::prev(upper);
+		while(lower != vec.begin() && *std::prev(lower) == target)
+		{
+			lower--;
+		}
+		scanned += std::distance(lower, upper);
+	}
+	const auto scan_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	counters.stop();
+	std::cout << "Search and scan: " << counters.report(targets.size(), "lookup") << std::endl;
+	
+	long bounded = 0;
+	counters.start();
+	start = std::chrono::steady_clock::now();
+	for(const auto target : targets)
+	{
+		bounded += std::distance(lower_bound_position(vec.begin(), vec.end(), target), upper_bound_position(vec.begin(), vec.end(), target));
+	}
+	const auto bounds_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	counters.stop();
+	std::cout << "Two searches: " << counters.report(targets.size(), "lookup") << std::endl;
+	
+	long ranged = 0;
+	counters.start();
+	start = std::chrono::steady_clock::now();
+	for(const auto target : targets)
+	{
+		const auto range = equal_range_position(vec.begin(), vec.end(), target);
+		ranged += std::distance(range.first, range.second);
+	}
+	const auto range_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	counters.stop();
+	std::cout << "equal_range_position: " << counters.report(targets.size(), "lookup") << std::endl;
+	
+	if(scanned == ranged && bounded == ranged)
+	{
+		std::cout << "Test 11 (range query speed): Passed. Search and scan " << scan_time << " s, two searches " << bounds_time << " s, equal_range_position " << range_time << " s" << std::endl;
+	}
+	else
+	{
+		std::cout << "Test 11 (range query speed): Failed. Expected " << scanned << " matches, Actual: " << ranged << std::endl;
+	}
+}
+
+// Test 12: Lookups in a constant table fold at compile time and agree with the same lookups at run time
+constexpr std::array<int, 10> constant_table = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29};
+static_assert(*binary_search_position(constant_table.begin(), constant_table.end(), 13) == 13);
+static_assert(binary_search_position(constant_table.begin(), constant_table.end(), 14) - constant_table.begin() == 6);
+static_assert(binary_search_position(constant_table.begin(), constant_table.end(), 30) == constant_table.end());
+static_assert(lower_bound_position(constant_table.begin(), constant_table.end(), 1) == constant_table.begin());
+static_assert(equal_range_position(constant_table.begin(), constant_table.end(), 29).first - constant_table.begin() == 9);
+
+void test_constexpr_lookup()
+{
+	bool passed = true;
+	const std::vector<int> vec(constant_table.begin(), constant_table.end());
+	constexpr auto folded = binary_search_position(constant_table.begin(), constant_table.end(), 17) - constant_table.begin();
+	passed = passed && binary_search_position(vec.begin(), vec.end(), 17) - vec.begin() == folded;
+	for(int target = 2; target <= 30; target++)
+	{
+		passed = passed && binary_search_position(constant_table.begin(), constant_table.end(), target) - constant_table.begin() == binary_search_position(vec.begin(), vec.end(), target) - vec.begin();
+	}
+	std::cout << "Test 12 (compile time lookup): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
 int main()
 {
 	std::cout << "Binary search tests started" << std::endl;
@@ -219,6 +395,10 @@ int main()
 	test_vector_double();
 	test_set_string();
 	test_list_int();
+	test_bounds_duplicates();
+	test_bounds_edge_cases();
+	test_bounds_speed();
+	test_constexpr_lookup();
 	
 	return 0;
 }
\ No newline at end of file
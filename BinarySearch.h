@@ -0,0 +1,45 @@
+// Binary search shared by the searching, set and index code https://en.wikipedia.org/wiki/Binary_search_algorithm
+#ifndef BINARY_SEARCH_H
+#define BINARY_SEARCH_H
+
+#include <iterator>
+
+// Return iterator pointing to the location where target was found. If target was not found, the location of where it would be is returned.
+template <typename Iter, typename T>
+constexpr Iter binary_search_position(Iter first, Iter last, const T target)
+{
+	// Container has 0 or 1 elements
+	if(first == last || std::next(first) == last)
+	{
+		return first;
+	}
+	
+	// Move iterator to point to last element
+	last--;
+		
+	while(first != last)
+	{
+		// Calculate the mid point between first and last
+		auto mid = first;
+		std::advance(mid, std::distance(first, std::next(last)) / 2);// Calling next on last is to cause rounding up in the case the distance is odd
+		if(*mid > target)
+		{
+			last = std::prev(mid);
+		}
+		else
+		{
+			first = mid;
+		}
+	}
+	if(*last == target)
+	{
+		return last;
+	}
+	else
+	{
+		// Target not found, return iterator to position where target would go
+		return std::next(last);
+	}
+}
+
+#endif
@@ -0,0 +1,403 @@
+// Compressed sorted array of 64-bit keys with block-wise frame-of-reference / delta encoding https://en.wikipedia.org/wiki/Delta_encoding
+#include <iostream>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <chrono>
+#include "PerfCounters.h"
+#include "BinarySearch.h"
+
+// Strictly increasing 64-bit keys split into blocks of 128. Each block keeps its smallest key in an
+// uncompressed top level array and stores the rest in whichever encoding is smallest:
+// frame-of-reference (key - block minimum) or delta (key - previous key), in 1, 2, 4 or 8 bytes.
+// A lookup binary searches the top level, then decodes and scans a single block.
+class CompressedSortedArray
+{
+public:
+	static constexpr std::size_t blockSize = 128;
+
+	// Empty if keys are not strictly increasing
+	static std::optional<CompressedSortedArray> build(const std::vector<std::uint64_t> &keys);
+
+	std::size_t size() const { return count; }
+
+	// Bytes used by the encoded keys and their block index
+	std::size_t memoryBytes() const;
+
+	// Decode the key at index i
+	std::uint64_t at(const std::size_t i) const;
+
+	// Index of the first key not less than target, size() if every key is smaller
+	std::size_t lowerBound(const std::uint64_t target) const;
+
+	bool contains(const std::uint64_t target) const;
+
+private:
+	enum class Encoding : std::uint8_t { For8, For16, For32, For64, Delta8, Delta16, Delta32 };
+
+	struct Block
+	{
+		std::uint64_t offset; // Index into the array that matches the encoding, which can pass 2^32 entries
+		Encoding encoding;
+		std::uint8_t length; // Keys in this block after the minimum
+	};
+
+	explicit CompressedSortedArray(const std::vector<std::uint64_t> &keys);
+
+	// Number of block keys below target
+	std::size_t scanBlock(const std::size_t b, const std::uint64_t target) const;
+
+	std::size_t count = 0;
+	std::vector<std::uint64_t> minimums;
+	std::vector<Block> blocks;
+	std::vector<std::uint8_t> packed8;
+	std::vector<std::uint16_t> packed16;
+	std::vector<std::uint32_t> packed32;
+	std::vector<std::uint64_t> packed64;
+};
+
+// Bytes needed to hold value
+std::size_t byteWidth(const std::uint64_t value)
+{
+	if(value <= std::numeric_limits<std::uint8_t>::max()) return 1;
+	if(value <= std::numeric_limits<std::uint16_t>::max()) return 2;
+	if(value <= std::numeric_limits<std::uint32_t>::max()) return 4;
+	return 8;
+}
+
+// Append values to storage narrowed to W, returns where they start
+template<typename W>
+std::uint64_t appendPacked(std::vector<W> &storage, const std::vector<std::uint64_t> &values)
+{
+	const auto offset = static_cast<std::uint64_t>(storage.size());
+	for(const auto v : values)
+	{
+		storage.push_back(static_cast<W>(v));
+	}
+	return offset;
+}
+
+std::optional<CompressedSortedArray> CompressedSortedArray::build(const std::vector<std::uint64_t> &keys)
+{
+	// Offsets and deltas are unsigned, a repeated or smaller key would wrap and encode garbage
+	if(std::adjacent_find(keys.begin(), keys.end(), [](std::uint64_t a, std::uint64_t b) { return a >= b; }) != keys.end())
+	{
+		return std::nullopt;
+	}
+	return CompressedSortedArray(keys);
+}
+
+CompressedSortedArray::CompressedSortedArray(const std::vector<std::uint64_t> &keys) : count(keys.size())
+{
+	std::vector<std::uint64_t> offsets;
+	std::vector<std::uint64_t> deltas;
+	for(std::size_t first = 0; first < keys.size(); first += blockSize)
+	{
+		const std::size_t last = std::min(first + blockSize, keys.size());
+		const auto minimum = keys[first];
+		offsets.clear();
+		deltas.clear();
+		for(std::size_t i = first + 1; i < last; i++)
+		{
+			offsets.push_back(keys[i] - minimum);
+			deltas.push_back(keys[i] - keys[i - 1]);
+		}
+		const std::size_t forWidth = offsets.empty() ? 1 : byteWidth(offsets.back());
+		const std::size_t deltaWidth = deltas.empty() ? 1 : byteWidth(*std::max_element(deltas.begin(), deltas.end()));
+
+		Block block;
+		block.length = static_cast<std::uint8_t>(last - first - 1);
+		// Frame-of-reference scans without a running sum, so it wins ties
+		if(forWidth <= deltaWidth || deltaWidth == 8)
+		{
+			switch(forWidth)
+			{
+				case 1: block.encoding = Encoding::For8; block.offset = appendPacked(packed8, offsets); break;
+				case 2: block.encoding = Encoding::For16; block.offset = appendPacked(packed16, offsets); break;
+				case 4: block.encoding = Encoding::For32; block.offset = appendPacked(packed32, offsets); break;
+				default: block.encoding = Encoding::For64; block.offset = appendPacked(packed64, offsets); break;
+			}
+		}
+		else
+		{
+			switch(deltaWidth)
+			{
+				case 1: block.encoding = Encoding::Delta8; block.offset = appendPacked(packed8, deltas); break;
+				case 2: block.encoding = Encoding::Delta16; block.offset = appendPacked(packed16, deltas); break;
+				default: block.encoding = Encoding::Delta32; block.offset = appendPacked(packed32, deltas); break;
+			}
+		}
+		minimums.push_back(minimum);
+		blocks.push_back(block);
+	}
+	packed8.shrink_to_fit();
+	packed16.shrink_to_fit();
+	packed32.shrink_to_fit();
+	packed64.shrink_to_fit();
+}
+
+std::size_t CompressedSortedArray::memoryBytes() const
+{
+	return minimums.size() * sizeof(std::uint64_t) + blocks.size() * sizeof(Block)
+		+ packed8.size() + packed16.size() * 2 + packed32.size() * 4 + packed64.size() * 8;
+}
+
+std::uint64_t CompressedSortedArray::at(const std::size_t i) const
+{
+	assert(i < count);
+	const auto b = i / blockSize;
+	const auto k = i % blockSize;
+	const auto &block = blocks[b];
+	if(k == 0)
+	{
+		return minimums[b];
+	}
+	switch(block.encoding)
+	{
+		case Encoding::For8: return minimums[b] + packed8[block.offset + k - 1];
+		case Encoding::For16: return minimums[b] + packed16[block.offset + k - 1];
+		case Encoding::For32: return minimums[b] + packed32[block.offset + k - 1];
+		case Encoding::For64: return minimums[b] + packed64[block.offset + k - 1];
+		default: break;
+	}
+	std::uint64_t value = minimums[b];
+	for(std::size_t j = 0; j < k; j++)
+	{
+		switch(block.encoding)
+		{
+			case Encoding::Delta8: value += packed8[block.offset + j]; break;
+			case Encoding::Delta16: value += packed16[block.offset + j]; break;
+			default: value += packed32[block.offset + j]; break;
+		}
+	}
+	return value;
+}
+
+// Frame-of-reference block: count the stored offsets below target in one branch free pass
+template<typename W>
+std::size_t countBelow(const W *values, const std::size_t n, const std::uint64_t target)
+{
+	if(target > std::numeric_limits<W>::max())
+	{
+		return n;
+	}
+	const W narrowed = static_cast<W>(target);
+	std::size_t below = 0;
+	for(std::size_t i = 0; i < n; i++)
+	{
+		below += values[i] < narrowed;
+	}
+	return below;
+}
+
+// Delta block: running sum until it reaches target
+template<typename W>
+std::size_t countBelowDelta(const W *deltas, const std::size_t n, const std::uint64_t target)
+{
+	std::uint64_t value = 0;
+	for(std::size_t i = 0; i < n; i++)
+	{
+		value += deltas[i];
+		if(value >= target)
+		{
+			return i;
+		}
+	}
+	return n;
+}
+
+std::size_t CompressedSortedArray::scanBlock(const std::size_t b, const std::uint64_t target) const
+{
+	const auto &block = blocks[b];
+	const auto relative = target - minimums[b]; // target > minimum, so this is the offset to look for
+	switch(block.encoding)
+	{
+		case Encoding::For8: return countBelow(packed8.data() + block.offset, block.length, relative);
+		case Encoding::For16: return countBelow(packed16.data() + block.offset, block.length, relative);
+		case Encoding::For32: return countBelow(packed32.data() + block.offset, block.length, relative);
+		case Encoding::For64: return countBelow(packed64.data() + block.offset, block.length, relative);
+		case Encoding::Delta8: return countBelowDelta(packed8.data() + block.offset, block.length, relative);
+		case Encoding::Delta16: return countBelowDelta(packed16.data() + block.offset, block.length, relative);
+		case Encoding::Delta32: return countBelowDelta(packed32.data() + block.offset, block.length, relative);
+	}
+	return block.length;
+}
+
+std::size_t CompressedSortedArray::lowerBound(const std::uint64_t target) const
+{
+	if(count == 0 || target <= minimums.front())
+	{
+		return 0;
+	}
+	// Last block whose minimum is not greater than target
+	auto it = binary_search_position(minimums.begin(), minimums.end(), target);
+	auto b = static_cast<std::size_t>(it - minimums.begin());
+	if(it != minimums.end() && *it == target)
+	{
+		return b * blockSize;
+	}
+	if(it == minimums.end() || *it > target)
+	{
+		b--; // Insertion position, the block that can hold target is the one before it
+	}
+	// Block minimum is below target, so skip it and count the rest
+	return b * blockSize + 1 + scanBlock(b, target);
+}
+
+bool CompressedSortedArray::contains(const std::uint64_t target) const
+{
+	const auto i = lowerBound(target);
+	return i < count && at(i) == target;
+}
+
+// Sorted unique keys with gaps drawn from [1, maxGap]
+std::vector<std::uint64_t> makeKeys(const std::size_t n, const std::uint64_t maxGap, const std::uint64_t start, std::mt19937_64 &gen)
+{
+	std::uniform_int_distribution<std::uint64_t> gap(1, maxGap);
+	std::vector<std::uint64_t> keys;
+	keys.reserve(n);
+	std::uint64_t key = start;
+	for(std::size_t i = 0; i < n; i++)
+	{
+		keys.push_back(key);
+		key += gap(gen);
+	}
+	return keys;
+}
+
+// True if lowerBound and contains agree with std::lower_bound for every key, every gap and both ends
+bool matchesUncompressed(const std::vector<std::uint64_t> &keys)
+{
+	const auto built = CompressedSortedArray::build(keys);
+	if(!built || built->size() != keys.size())
+	{
+		return false;
+	}
+	const auto &compressed = *built;
+	std::vector<std::uint64_t> targets = {0, std::numeric_limits<std::uint64_t>::max()};
+	for(const auto key : keys)
+	{
+		targets.push_back(key);
+		targets.push_back(key + 1);
+		if(key > 0) targets.push_back(key - 1);
+	}
+	for(const auto target : targets)
+	{
+		const auto expected = static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), target) - keys.begin());
+		if(compressed.lowerBound(target) != expected)
+		{
+			return false;
+		}
+		if(compressed.contains(target) != std::binary_search(keys.begin(), keys.end(), target))
+		{
+			return false;
+		}
+	}
+	for(std::size_t i = 0; i < keys.size(); i++)
+	{
+		if(compressed.at(i) != keys[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compressed search tests
+// Test 1: Empty and tiny arrays
+void test_small_arrays()
+{
+	bool passed = matchesUncompressed({}) && matchesUncompressed({42}) && matchesUncompressed({1, 2}) && matchesUncompressed({0, 1000000, std::numeric_limits<std::uint64_t>::max()});
+	std::cout << "Test 1 (small arrays): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 2: Every block encoding, including partial last blocks
+void test_encodings()
+{
+	std::mt19937_64 gen(2);
+	bool passed = true;
+	// Dense (8-bit deltas), medium (16-bit), wide (32-bit) and sparse (full 64-bit) gaps
+	for(const std::uint64_t maxGap : {std::uint64_t{1}, std::uint64_t{200}, std::uint64_t{60000}, std::uint64_t{1} << 30, std::uint64_t{1} << 52})
+	{
+		passed = passed && matchesUncompressed(makeKeys(1000, maxGap, 5, gen));
+		passed = passed && matchesUncompressed(makeKeys(128, maxGap, 0, gen));
+		passed = passed && matchesUncompressed(makeKeys(129, maxGap, 0, gen));
+	}
+	// Keys near the top of the range
+	passed = passed && matchesUncompressed(makeKeys(300, 1000, std::numeric_limits<std::uint64_t>::max() - 400000, gen));
+	std::cout << "Test 2 (block encodings): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 3: Keys that are not strictly increasing are rejected
+void test_unsorted_keys()
+{
+	bool passed = !CompressedSortedArray::build({1, 1}) && !CompressedSortedArray::build({5, 3, 7}) && CompressedSortedArray::build({3, 5, 7});
+	// A repeat deep inside a later block, after plenty of valid ones
+	std::mt19937_64 gen(5);
+	auto keys = makeKeys(1000, 200, 0, gen);
+	keys[700] = keys[699];
+	passed = passed && !CompressedSortedArray::build(keys);
+	std::cout << "Test 3 (unsorted keys): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 4: Memory and lookup speed against binary_search_position on the uncompressed keys
+void test_memory_and_speed()
+{
+	std::mt19937_64 gen(3);
+	bool passed = true;
+	for(const std::uint64_t maxGap : {std::uint64_t{200}, std::uint64_t{60000}})
+	{
+		const auto keys = makeKeys(10000000, maxGap, 1000, gen);
+		const auto compressed = *CompressedSortedArray::build(keys);
+		std::vector<std::uint64_t> targets(2000000);
+		for(auto &t : targets)
+		{
+			t = keys[gen() % keys.size()] + gen() % 2; // Half hits, half misses
+		}
+
+		PerfCounters counters;
+		std::size_t plainHits = 0;
+		counters.start();
+		auto start = std::chrono::steady_clock::now();
+		for(const auto target : targets)
+		{
+			auto it = binary_search_position(keys.begin(), keys.end(), target);
+			plainHits += it != keys.end() && *it == target;
+		}
+		const auto plainTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		counters.stop();
+		std::cout << "Uncompressed: " << counters.report(targets.size(), "lookup") << std::endl;
+
+		std::size_t compressedHits = 0;
+		counters.start();
+		start = std::chrono::steady_clock::now();
+		for(const auto target : targets)
+		{
+			compressedHits += compressed.contains(target);
+		}
+		const auto compressedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		counters.stop();
+		std::cout << "Compressed: " << counters.report(targets.size(), "lookup") << std::endl;
+
+		const double ratio = static_cast<double>(keys.size() * sizeof(std::uint64_t)) / compressed.memoryBytes();
+		passed = passed && plainHits == compressedHits;
+		std::cout << "Gaps up to " << maxGap << ": " << ratio << "x smaller, lookups " << compressedTime / plainTime << "x the uncompressed time" << std::endl;
+	}
+	std::cout << "Test 4 (memory and speed): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+int main()
+{
+	std::cout << "Compressed search tests started" << std::endl;
+
+	test_small_arrays();
+	test_encodings();
+	test_unsorted_keys();
+	test_memory_and_speed();
+
+	return 0;
+}
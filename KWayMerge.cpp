@@ -0,0 +1,442 @@
+// Implementation of k-way merge with a tournament (loser) tree https://en.wikipedia.org/wiki/K-way_merge_algorithm#Tournament_Tree
+#include <iostream>
+#include <vector>
+#include <list>
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <chrono>
+#include <string>
+#include <new>
+#include <cstdlib>
+#include "SortContext.h"
+
+// Loser tree over k sorted runs. Each node stores the run that lost the match played there,
+// node 0 holds the overall winner. Popping the winner replays only its path to the root, so each
+// output element costs log2(k) comparisons no matter how many runs there are.
+// All of its storage comes from ctx, so the caller must hold a SortContext::Scope for its lifetime.
+template<typename Iter>
+class LoserTree
+{
+public:
+	LoserTree(const std::vector<std::pair<Iter, Iter>> &runs, SortContext &ctx);
+
+	// True once every run is exhausted
+	bool empty() const;
+
+	// Iterator to the smallest remaining element
+	Iter top() const;
+
+	// Advance the winning run and replay its matches
+	void pop();
+
+private:
+	// Exhausted runs lose every match, ties go to the lower run index so the merge is stable
+	bool beats(const std::size_t a, const std::size_t b) const;
+
+	ScratchVector<Iter> heads;
+	ScratchVector<Iter> ends;
+	ScratchVector<std::size_t> tree;
+};
+
+template<typename Iter>
+LoserTree<Iter>::LoserTree(const std::vector<std::pair<Iter, Iter>> &runs, SortContext &ctx)
+	: heads(ArenaAllocator<Iter>(ctx)), ends(ArenaAllocator<Iter>(ctx)), tree(ArenaAllocator<std::size_t>(ctx))
+{
+	const std::size_t k = runs.size();
+	heads.reserve(k);
+	ends.reserve(k);
+	for(const auto &run : runs)
+	{
+		heads.push_back(run.first);
+		ends.push_back(run.second);
+	}
+	if(k == 0)
+	{
+		return;
+	}
+
+	// Play the initial tournament bottom up, leaves live at [k, 2k)
+	tree.assign(k, 0);
+	ScratchVector<std::size_t> winners(2 * k, 0, ArenaAllocator<std::size_t>(ctx));
+	for(std::size_t i = 0; i < k; i++)
+	{
+		winners[k + i] = i;
+	}
+	for(std::size_t node = k - 1; node > 0; node--)
+	{
+		const auto lft = winners[2 * node];
+		const auto rgt = winners[2 * node + 1];
+		if(beats(rgt, lft))
+		{
+			winners[node] = rgt;
+			tree[node] = lft;
+		}
+		else
+		{
+			winners[node] = lft;
+			tree[node] = rgt;
+		}
+	}
+	tree[0] = k == 1 ? 0 : winners[1];
+}
+
+template<typename Iter>
+bool LoserTree<Iter>::empty() const
+{
+	return tree.empty() || heads[tree[0]] == ends[tree[0]];
+}
+
+template<typename Iter>
+Iter LoserTree<Iter>::top() const
+{
+	assert(!empty());
+	return heads[tree[0]];
+}
+
+template<typename Iter>
+void LoserTree<Iter>::pop()
+{
+	assert(!empty());
+	auto winner = tree[0];
+	std::advance(heads[winner], 1);
+	for(auto node = (tree.size() + winner) / 2; node > 0; node /= 2)
+	{
+		if(beats(tree[node], winner))
+		{
+			std::swap(tree[node], winner);
+		}
+	}
+	tree[0] = winner;
+}
+
+template<typename Iter>
+bool LoserTree<Iter>::beats(const std::size_t a, const std::size_t b) const
+{
+	if(heads[a] == ends[a])
+	{
+		return false;
+	}
+	if(heads[b] == ends[b])
+	{
+		return true;
+	}
+	if(*heads[a] < *heads[b])
+	{
+		return true;
+	}
+	return !(*heads[b] < *heads[a]) && a < b;
+}
+
+// Merge k sorted runs into out, returns the iterator one past the last element written
+template<typename Iter, typename OutIter>
+OutIter kWayMerge(const std::vector<std::pair<Iter, Iter>> &runs, OutIter out, SortContext &ctx)
+{
+	SortContext::Scope scope(ctx);
+	LoserTree<Iter> tree(runs, ctx);
+	while(!tree.empty())
+	{
+		*out = *tree.top();
+		++out;
+		tree.pop();
+	}
+	return out;
+}
+
+template<typename Iter, typename OutIter>
+OutIter kWayMerge(const std::vector<std::pair<Iter, Iter>> &runs, OutIter out)
+{
+	return kWayMerge(runs, out, threadSortContext());
+}
+
+// Merge k sorted runs, handing each element to sink in order
+template<typename Iter, typename Sink>
+void kWayMergeToSink(const std::vector<std::pair<Iter, Iter>> &runs, Sink sink, SortContext &ctx)
+{
+	SortContext::Scope scope(ctx);
+	LoserTree<Iter> tree(runs, ctx);
+	while(!tree.empty())
+	{
+		sink(*tree.top());
+		tree.pop();
+	}
+}
+
+template<typename Iter, typename Sink>
+void kWayMergeToSink(const std::vector<std::pair<Iter, Iter>> &runs, Sink sink)
+{
+	kWayMergeToSink(runs, sink, threadSortContext());
+}
+
+// Merge k sorted runs through a buffer of at most bufferSize elements. sink receives each full
+// buffer (and the final partial one) as a const ScratchVector&, the buffer is reused between calls
+// so memory use stays bounded no matter how large the merged output is.
+template<typename Iter, typename Sink>
+void kWayMergeBuffered(const std::vector<std::pair<Iter, Iter>> &runs, const std::size_t bufferSize, Sink sink, SortContext &ctx)
+{
+	assert(bufferSize > 0);
+	SortContext::Scope scope(ctx);
+	using T = typename std::iterator_traits<Iter>::value_type;
+	ScratchVector<T> buffer{ArenaAllocator<T>(ctx)};
+	buffer.reserve(bufferSize);
+	const auto &chunk = buffer; // Sink only gets read access
+	LoserTree<Iter> tree(runs, ctx);
+	while(!tree.empty())
+	{
+		buffer.push_back(*tree.top());
+		tree.pop();
+		if(buffer.size() == bufferSize)
+		{
+			sink(chunk);
+			buffer.clear();
+		}
+	}
+	if(!buffer.empty())
+	{
+		sink(chunk);
+	}
+}
+
+template<typename Iter, typename Sink>
+void kWayMergeBuffered(const std::vector<std::pair<Iter, Iter>> &runs, const std::size_t bufferSize, Sink sink)
+{
+	kWayMergeBuffered(runs, bufferSize, sink, threadSortContext());
+}
+
+// Split vec into k shards and sort each one, returns the [begin, end) of every shard
+std::vector<std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>> makeSortedShards(std::vector<int> &vec, const std::size_t k)
+{
+	std::vector<std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>> runs;
+	for(std::size_t i = 0; i < k; i++)
+	{
+		auto first = vec.begin() + vec.size() * i / k;
+		auto last = vec.begin() + vec.size() * (i + 1) / k;
+		std::sort(first, last);
+		runs.emplace_back(first, last);
+	}
+	return runs;
+}
+
+// Counts every heap allocation made by the program so tests can check the steady state makes none
+static std::size_t allocationCount = 0;
+
+void *operator new(std::size_t bytes)
+{
+	allocationCount++;
+	if(void *p = std::malloc(bytes ? bytes : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// K-way merge tests
+// Functional test cases
+// Test case 1: no runs at all
+void testNoRuns()
+{
+	std::vector<std::pair<std::vector<int>::iterator, std::vector<int>::iterator>> runs;
+	std::vector<int> out;
+	kWayMerge(runs, std::back_inserter(out));
+	assert(out.empty());
+}
+
+// Test case 2: a single run is copied unchanged
+void testSingleRun()
+{
+	std::vector<int> vec = {1, 2, 3, 4, 5};
+	std::vector<std::pair<std::vector<int>::iterator, std::vector<int>::iterator>> runs = {{vec.begin(), vec.end()}};
+	std::vector<int> out;
+	kWayMerge(runs, std::back_inserter(out));
+	assert(out == vec);
+}
+
+// Test case 3: empty runs mixed in with non-empty ones
+void testEmptyRuns()
+{
+	std::vector<int> a = {1, 4, 9};
+	std::vector<int> b;
+	std::vector<int> c = {2, 3, 10};
+	std::vector<std::pair<std::vector<int>::iterator, std::vector<int>::iterator>> runs = {{b.begin(), b.end()}, {a.begin(), a.end()}, {b.begin(), b.end()}, {c.begin(), c.end()}};
+	std::vector<int> out;
+	kWayMerge(runs, std::back_inserter(out));
+	assert((out == std::vector<int>{1, 2, 3, 4, 9, 10}));
+}
+
+// Element ordered by key only, tag records which run it came from
+struct Tagged
+{
+	int key;
+	char tag;
+	bool operator<(const Tagged &other) const { return key < other.key; }
+};
+
+// Test case 4: equal elements come out in run order
+void testStableDuplicates()
+{
+	std::vector<Tagged> a = {{1, 'a'}, {2, 'a'}};
+	std::vector<Tagged> b = {{1, 'b'}, {2, 'b'}};
+	std::vector<Tagged> c = {{1, 'c'}};
+	std::vector<std::pair<std::vector<Tagged>::iterator, std::vector<Tagged>::iterator>> runs = {{a.begin(), a.end()}, {b.begin(), b.end()}, {c.begin(), c.end()}};
+	std::vector<int> keys;
+	std::string tags;
+	kWayMergeToSink(runs, [&](const Tagged &element)
+	{
+		keys.push_back(element.key);
+		tags.push_back(element.tag);
+	});
+	assert((keys == std::vector<int>{1, 1, 1, 2, 2}));
+	assert(tags == "abcab");
+}
+
+// Test case 5: runs held in lists
+void testListRuns()
+{
+	std::list<int> a = {5, 10, 15};
+	std::list<int> b = {1, 20};
+	std::vector<std::pair<std::list<int>::const_iterator, std::list<int>::const_iterator>> runs = {{a.cbegin(), a.cend()}, {b.cbegin(), b.cend()}};
+	std::vector<int> out(5);
+	auto last = kWayMerge(runs, out.begin());
+	assert(last == out.end());
+	assert((out == std::vector<int>{1, 5, 10, 15, 20}));
+}
+
+// Test case 6: buffered output never hands more than bufferSize elements to the sink
+void testBufferedChunks()
+{
+	std::vector<int> vec = {9, 3, 7, 1, 8, 2, 6, 4, 5, 0, 11};
+	auto runs = makeSortedShards(vec, 3);
+	std::vector<int> out;
+	std::size_t calls = 0;
+	kWayMergeBuffered(runs, 4, [&](const ScratchVector<int> &chunk)
+	{
+		assert(!chunk.empty() && chunk.size() <= 4);
+		out.insert(out.end(), chunk.begin(), chunk.end());
+		calls++;
+	});
+	assert(calls == 3);
+	assert((out == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11}));
+}
+
+// Stress Test Cases
+// Test 1: hundreds of shards, compared against sorting the whole input
+void testManyShards()
+{
+	const std::size_t n = 10000000;
+	const std::size_t k = 500;
+	std::mt19937 gen(42);
+	std::vector<int> vec(n);
+	for(auto &x : vec)
+	{
+		x = static_cast<int>(gen());
+	}
+	auto expected = vec;
+	std::sort(expected.begin(), expected.end());
+
+	auto runs = makeSortedShards(vec, k);
+	std::vector<int> out(n);
+	auto start = std::chrono::steady_clock::now();
+	kWayMerge(runs, out.begin());
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	assert(out == expected);
+	std::cout << "Merged " << k << " runs of " << n << " ints in " << elapsed << " s" << std::endl;
+}
+
+// Test 2: streaming merge of many small runs through a small buffer
+void testStreamingShards()
+{
+	const std::size_t n = 1000000;
+	const std::size_t k = 300;
+	std::vector<int> vec(n);
+	for(std::size_t i = 0; i < n; i++)
+	{
+		vec[i] = static_cast<int>((i * 7919) % 100003); // Lots of duplicates across runs
+	}
+	auto runs = makeSortedShards(vec, k);
+	std::size_t count = 0;
+	int previous = -1;
+	kWayMergeBuffered(runs, 4096, [&](const ScratchVector<int> &chunk)
+	{
+		assert(chunk.size() <= 4096);
+		for(const auto x : chunk)
+		{
+			assert(previous <= x);
+			previous = x;
+		}
+		count += chunk.size();
+	});
+	assert(count == n);
+}
+
+// Test 3: repeated merges through one context allocate nothing after the first
+void testContextReuse()
+{
+	std::vector<int> vec(200000);
+	for(std::size_t i = 0; i < vec.size(); i++)
+	{
+		vec[i] = static_cast<int>((i * 7919) % 100003);
+	}
+	auto runs = makeSortedShards(vec, 256);
+	std::vector<int> out(vec.size());
+	SortContext ctx;
+	long checksum = 0;
+	auto sink = [&](const ScratchVector<int> &chunk)
+	{
+		for(const auto x : chunk)
+		{
+			checksum += x;
+		}
+	};
+	kWayMerge(runs, out.begin(), ctx);
+	kWayMergeBuffered(runs, 1024, sink, ctx);
+	const auto peak = ctx.peakUsage();
+	assert(peak > 0);
+	
+	const auto before = allocationCount;
+	for(int round = 0; round < 20; round++)
+	{
+		kWayMerge(runs, out.begin(), ctx);
+		kWayMergeBuffered(runs, 1024, sink, ctx);
+	}
+	assert(allocationCount == before);
+	assert(ctx.peakUsage() == peak);
+	assert(std::is_sorted(out.begin(), out.end()));
+	std::cout << "Scratch peak " << peak << " bytes, " << allocationCount - before << " allocations in steady state" << std::endl;
+}
+
+int main()
+{
+	std::cout << "Started" << std::endl;
+	testNoRuns();
+	std::cout << "K-way merge functional test 1 passed" << std::endl;
+	testSingleRun();
+	std::cout << "K-way merge functional test 2 passed" << std::endl;
+	testEmptyRuns();
+	std::cout << "K-way merge functional test 3 passed" << std::endl;
+	testStableDuplicates();
+	std::cout << "K-way merge functional test 4 passed" << std::endl;
+	testListRuns();
+	std::cout << "K-way merge functional test 5 passed" << std::endl;
+	testBufferedChunks();
+	std::cout << "K-way merge functional test 6 passed" << std::endl;
+	testManyShards();
+	std::cout << "K-way merge stress test 1 passed" << std::endl;
+	testStreamingShards();
+	std::cout << "K-way merge stress test 2 passed" << std::endl;
+	testContextReuse();
+	std::cout << "K-way merge stress test 3 passed" << std::endl;
+	std::cout << "Completed" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,681 @@
+// Versioned on-disk sorted index searched in place through mmap https://en.wikipedia.org/wiki/Mmap
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+#include <fstream>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <random>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "BinarySearch.h"
+
+// File layout, all offsets from the start of the file:
+//   header    64 bytes
+//   keys      count fixed-width keys in ascending order, at keysOffset (64 byte aligned)
+//   offsets   count + 1 uint64 offsets into the payload bytes, at payloadOffsetsOffset (0 if no payloads)
+//   payloads  concatenated payload bytes, at payloadBytesOffset
+// Everything is stored in the writer's byte order, which the reader checks through byteOrder.
+struct MappedIndexHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t keyWidth;
+	std::uint32_t flags;
+	std::uint64_t count;
+	std::uint64_t keysOffset;
+	std::uint64_t payloadOffsetsOffset;
+	std::uint64_t payloadBytesOffset;
+	std::uint64_t fileSize;
+};
+static_assert(sizeof(MappedIndexHeader) == 64, "header layout must not depend on the compiler");
+
+constexpr char mappedIndexMagic[8] = {'S', 'O', 'R', 'T', 'I', 'D', 'X', '\0'};
+constexpr std::uint32_t mappedIndexVersion = 1;
+constexpr std::uint32_t mappedIndexByteOrder = 0x01020304;
+
+// Header flags. The key kind is recorded so an index of int32_t isn't opened as uint32_t or float.
+constexpr std::uint32_t indexKeySigned = 1;
+constexpr std::uint32_t indexKeyFloat = 2;
+constexpr std::uint32_t indexHasPayloads = 4;
+
+template <typename Key>
+constexpr std::uint32_t indexKeyFlags()
+{
+	static_assert(std::is_arithmetic_v<Key>, "index keys must be fixed-width numbers");
+	return (std::is_signed_v<Key> ? indexKeySigned : 0) | (std::is_floating_point_v<Key> ? indexKeyFloat : 0);
+}
+
+constexpr std::uint64_t alignUp(const std::uint64_t value, const std::uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Collects keys (and optionally a payload per key), sorts them once and writes the index file.
+// Equal keys are allowed and keep the order they were added in.
+template <typename Key>
+class MappedIndexBuilder
+{
+public:
+	void reserve(const std::size_t n)
+	{
+		keys.reserve(n);
+	}
+
+	void add(const Key key)
+	{
+		keys.push_back(key);
+		if(!payloads.empty())
+		{
+			payloads.emplace_back();
+		}
+	}
+
+	// Once any key has a payload every key has one, empty for those added without
+	void add(const Key key, const std::string &payload)
+	{
+		payloads.resize(keys.size());
+		keys.push_back(key);
+		payloads.push_back(payload);
+	}
+
+	// Write to path + ".tmp", sync it and rename it over path, so readers never see a half written
+	// index, not even after a crash. Can be called again after adding more keys.
+	// Returns false if the file couldn't be written.
+	bool write(const std::string &path) const;
+
+private:
+	std::vector<Key> keys;
+	std::vector<std::string> payloads;
+};
+
+// Write all of size bytes to fd, false on any error
+bool writeAll(const int fd, const void *data, std::size_t size)
+{
+	const char *bytes = static_cast<const char *>(data);
+	while(size > 0)
+	{
+		const ssize_t written = ::write(fd, bytes, size);
+		if(written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(written <= 0)
+		{
+			return false;
+		}
+		bytes += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	return true;
+}
+
+template <typename Key>
+bool MappedIndexBuilder<Key>::write(const std::string &path) const
+{
+	// Sort a copy (keys only) or a permutation (with payloads), the builder itself is left as it was
+	const bool withPayloads = !payloads.empty();
+	std::vector<std::size_t> order;
+	std::vector<Key> sorted;
+	if(withPayloads)
+	{
+		order.resize(keys.size());
+		std::iota(order.begin(), order.end(), std::size_t{0});
+		std::stable_sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+		sorted.resize(keys.size());
+		for(std::size_t i = 0; i < order.size(); i++)
+		{
+			sorted[i] = keys[order[i]];
+		}
+	}
+	else
+	{
+		sorted = keys;
+		std::stable_sort(sorted.begin(), sorted.end());
+	}
+
+	MappedIndexHeader header = {};
+	std::memcpy(header.magic, mappedIndexMagic, sizeof(header.magic));
+	header.version = mappedIndexVersion;
+	header.byteOrder = mappedIndexByteOrder;
+	header.keyWidth = sizeof(Key);
+	header.flags = indexKeyFlags<Key>() | (withPayloads ? indexHasPayloads : 0);
+	header.count = sorted.size();
+	header.keysOffset = alignUp(sizeof(MappedIndexHeader), 64);
+	const std::uint64_t keysEnd = header.keysOffset + sorted.size() * sizeof(Key);
+	std::uint64_t end = keysEnd;
+
+	std::vector<std::uint64_t> offsets;
+	if(withPayloads)
+	{
+		offsets.reserve(sorted.size() + 1);
+		offsets.push_back(0);
+		for(const auto i : order)
+		{
+			offsets.push_back(offsets.back() + payloads[i].size());
+		}
+		header.payloadOffsetsOffset = alignUp(end, 8);
+		header.payloadBytesOffset = header.payloadOffsetsOffset + offsets.size() * sizeof(std::uint64_t);
+		end = header.payloadBytesOffset + offsets.back();
+	}
+	header.fileSize = end;
+
+	const std::string tmpPath = path + ".tmp";
+	const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		return false;
+	}
+	const char padding[64] = {};
+	bool ok = writeAll(fd, &header, sizeof(header));
+	ok = ok && writeAll(fd, padding, header.keysOffset - sizeof(header));
+	ok = ok && writeAll(fd, sorted.data(), sorted.size() * sizeof(Key));
+	if(withPayloads)
+	{
+		ok = ok && writeAll(fd, padding, header.payloadOffsetsOffset - keysEnd);
+		ok = ok && writeAll(fd, offsets.data(), offsets.size() * sizeof(std::uint64_t));
+		for(std::size_t k = 0; ok && k < order.size(); k++)
+		{
+			ok = writeAll(fd, payloads[order[k]].data(), payloads[order[k]].size());
+		}
+	}
+	// The data has to be on disk before the rename is, or a crash could leave the new name on an empty file
+	ok = ok && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if(!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	// And the rename itself survives a crash once the directory entry is synced
+	const auto slash = path.find_last_of('/');
+	const std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+	const int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dirFd >= 0)
+	{
+		fsync(dirFd);
+		close(dirFd);
+	}
+	return true;
+}
+
+// How the reader maps the file
+struct MapOptions
+{
+	bool populate = false; // MAP_POPULATE: fault every page in at open, slower open but no page faults on lookups
+	bool hugePages = false; // MADV_HUGEPAGE: only takes effect where the kernel backs file mappings with huge pages
+	bool randomAccess = true; // MADV_RANDOM: binary search jumps around, so readahead mostly reads pages nobody uses
+};
+
+// Read only view of an index file. The keys are searched where they lie in the mapping, nothing is
+// copied or parsed, so opening costs the same for any size of index unless populate is requested.
+template <typename Key>
+class MappedIndex
+{
+public:
+	// Empty if the file can't be opened or mapped, or isn't a valid index of Key
+	static std::optional<MappedIndex> open(const std::string &path, const MapOptions &options = {});
+
+	MappedIndex(MappedIndex &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	MappedIndex &operator=(MappedIndex &&other) noexcept
+	{
+		std::swap(base, other.base);
+		std::swap(length, other.length);
+		std::swap(count, other.count);
+		std::swap(keys, other.keys);
+		std::swap(payloadOffsets, other.payloadOffsets);
+		std::swap(payloadBytes, other.payloadBytes);
+		return *this;
+	}
+
+	MappedIndex(const MappedIndex &) = delete;
+	MappedIndex &operator=(const MappedIndex &) = delete;
+
+	~MappedIndex()
+	{
+		if(base)
+		{
+			munmap(base, length);
+		}
+	}
+
+	std::size_t size() const { return count; }
+	const Key *begin() const { return keys; }
+	const Key *end() const { return keys + count; }
+	bool hasPayloads() const { return payloadOffsets != nullptr; }
+
+	// Same index binary_search_position gives on the keys held in memory
+	std::size_t position(const Key target) const
+	{
+		return static_cast<std::size_t>(binary_search_position(begin(), end(), target) - begin());
+	}
+
+	// Index of target, empty if it isn't in the index
+	std::optional<std::size_t> find(const Key target) const
+	{
+		const auto i = position(target);
+		if(i < count && keys[i] == target)
+		{
+			return i;
+		}
+		return std::nullopt;
+	}
+
+	// Payload of the key at index i, empty if the index has no payloads or the offsets are corrupt
+	std::string_view payload(const std::size_t i) const
+	{
+		if(!payloadOffsets || i >= count)
+		{
+			return {};
+		}
+		const auto first = payloadOffsets[i];
+		const auto last = payloadOffsets[i + 1];
+		if(first > last || last > payloadOffsets[count])
+		{
+			return {};
+		}
+		return std::string_view(payloadBytes + first, last - first);
+	}
+
+private:
+	MappedIndex() = default;
+
+	void *base = nullptr;
+	std::size_t length = 0;
+	std::size_t count = 0;
+	const Key *keys = nullptr;
+	const std::uint64_t *payloadOffsets = nullptr;
+	const char *payloadBytes = nullptr;
+};
+
+// True if header describes an index of Key that fits in fileSize bytes. Only the header and the last
+// payload offset are checked, so validation doesn't touch the rest of the file either.
+template <typename Key>
+bool validIndexHeader(const MappedIndexHeader &header, const std::uint64_t fileSize)
+{
+	if(std::memcmp(header.magic, mappedIndexMagic, sizeof(header.magic)) != 0 || header.version != mappedIndexVersion || header.byteOrder != mappedIndexByteOrder)
+	{
+		return false;
+	}
+	if(header.keyWidth != sizeof(Key) || (header.flags & (indexKeySigned | indexKeyFloat)) != indexKeyFlags<Key>() || header.fileSize != fileSize)
+	{
+		return false;
+	}
+	if(header.keysOffset % alignof(Key) != 0 || header.keysOffset < sizeof(MappedIndexHeader) || header.keysOffset > fileSize || header.count > (fileSize - header.keysOffset) / sizeof(Key))
+	{
+		return false;
+	}
+	if(header.flags & indexHasPayloads)
+	{
+		const auto keysEnd = header.keysOffset + header.count * sizeof(Key);
+		if(header.payloadOffsetsOffset % alignof(std::uint64_t) != 0 || header.payloadOffsetsOffset < keysEnd || header.payloadBytesOffset < header.payloadOffsetsOffset || header.payloadBytesOffset > fileSize)
+		{
+			return false;
+		}
+		if(header.count + 1 > (header.payloadBytesOffset - header.payloadOffsetsOffset) / sizeof(std::uint64_t))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename Key>
+std::optional<MappedIndex<Key>> MappedIndex<Key>::open(const std::string &path, const MapOptions &options)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return std::nullopt;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(MappedIndexHeader)))
+	{
+		close(fd);
+		return std::nullopt;
+	}
+	const auto fileSize = static_cast<std::size_t>(info.st_size);
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if(options.populate)
+	{
+		flags |= MAP_POPULATE;
+	}
+#endif
+	void *base = mmap(nullptr, fileSize, PROT_READ, flags, fd, 0);
+	close(fd); // The mapping keeps the file alive
+	if(base == MAP_FAILED)
+	{
+		return std::nullopt;
+	}
+
+	MappedIndex index;
+	index.base = base;
+	index.length = fileSize;
+	const auto &header = *static_cast<const MappedIndexHeader *>(base);
+	if(!validIndexHeader<Key>(header, fileSize))
+	{
+		return std::nullopt;
+	}
+	const auto bytes = static_cast<const char *>(base);
+	index.count = header.count;
+	index.keys = reinterpret_cast<const Key *>(bytes + header.keysOffset);
+	if(header.flags & indexHasPayloads)
+	{
+		index.payloadOffsets = reinterpret_cast<const std::uint64_t *>(bytes + header.payloadOffsetsOffset);
+		index.payloadBytes = bytes + header.payloadBytesOffset;
+		if(index.payloadOffsets[header.count] != fileSize - header.payloadBytesOffset)
+		{
+			return std::nullopt;
+		}
+	}
+
+	// Hints only, the index works the same if the kernel ignores them
+	if(options.randomAccess)
+	{
+		madvise(base, fileSize, MADV_RANDOM);
+	}
+#ifdef MADV_HUGEPAGE
+	if(options.hugePages)
+	{
+		madvise(base, fileSize, MADV_HUGEPAGE);
+	}
+#endif
+	return index;
+}
+
+// Sorted keys with gaps drawn from [1, maxGap]
+std::vector<std::uint64_t> make_keys(const std::size_t n, const std::uint64_t maxGap, std::mt19937_64 &gen)
+{
+	std::uniform_int_distribution<std::uint64_t> gap(1, maxGap);
+	std::vector<std::uint64_t> keys(n);
+	std::uint64_t key = 0;
+	for(auto &k : keys)
+	{
+		key += gap(gen);
+		k = key;
+	}
+	return keys;
+}
+
+// True if position and find on the mapped index agree with binary_search_position on sorted for every target
+template <typename Key>
+bool matches_in_memory(const MappedIndex<Key> &index, const std::vector<Key> &sorted, const std::vector<Key> &targets)
+{
+	if(index.size() != sorted.size() || !std::equal(sorted.begin(), sorted.end(), index.begin()))
+	{
+		return false;
+	}
+	for(const auto target : targets)
+	{
+		const auto expected = binary_search_position(sorted.begin(), sorted.end(), target);
+		const auto found = index.find(target);
+		const bool hit = expected != sorted.end() && *expected == target;
+		if(index.position(target) != static_cast<std::size_t>(expected - sorted.begin()) || found.has_value() != hit)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Overwrite size bytes at offset in the file at path
+void patch_file(const std::string &path, const std::size_t offset, const void *data, const std::size_t size)
+{
+	std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+	file.seekp(static_cast<std::streamoff>(offset));
+	file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+}
+
+const std::string index_path = "/tmp/mapped_index_test.idx";
+
+// Mapped index tests
+// Test 1: Keys and payloads round trip, lookups match binary_search_position in memory
+void test_round_trip()
+{
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<std::int32_t> dist(-5000, 5000);
+	std::vector<std::pair<std::int32_t, std::string>> entries;
+	MappedIndexBuilder<std::int32_t> builder;
+	for(int i = 0; i < 20000; i++)
+	{
+		const auto key = dist(gen);
+		entries.emplace_back(key, "value " + std::to_string(i));
+		builder.add(key, entries.back().second);
+	}
+	bool passed = builder.write(index_path);
+
+	std::stable_sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	std::vector<std::int32_t> sorted;
+	for(const auto &entry : entries)
+	{
+		sorted.push_back(entry.first);
+	}
+	std::vector<std::int32_t> targets;
+	for(std::int32_t t = -5100; t <= 5100; t++)
+	{
+		targets.push_back(t);
+	}
+	targets.push_back(std::numeric_limits<std::int32_t>::min());
+	targets.push_back(std::numeric_limits<std::int32_t>::max());
+
+	const auto index = MappedIndex<std::int32_t>::open(index_path, MapOptions{true, true, true});
+	passed = passed && index && index->hasPayloads() && matches_in_memory(*index, sorted, targets);
+	for(std::size_t i = 0; passed && i < entries.size(); i++)
+	{
+		passed = index->payload(i) == entries[i].second;
+	}
+	passed = passed && index && index->payload(entries.size()).empty();
+
+	// Writing again, after adding more, pairs every key with its own payload as before
+	MappedIndexBuilder<std::int32_t> small;
+	small.add(3, "three");
+	small.add(1, "one");
+	passed = passed && small.write(index_path);
+	small.add(2, "two");
+	passed = passed && small.write(index_path);
+	const auto again = MappedIndex<std::int32_t>::open(index_path);
+	passed = passed && again && again->size() == 3;
+	for(std::int32_t key = 1; passed && key <= 3; key++)
+	{
+		const auto i = again->find(key);
+		passed = i && again->payload(*i) == std::vector<std::string>{"one", "two", "three"}[key - 1];
+	}
+	std::remove(index_path.c_str());
+	std::cout << "Test 1 (round trip with payloads): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 2: Empty, single key, keys without payloads and floating point keys
+void test_key_kinds()
+{
+	bool passed = true;
+	{
+		MappedIndexBuilder<std::uint64_t> builder;
+		passed = passed && builder.write(index_path);
+		const auto index = MappedIndex<std::uint64_t>::open(index_path);
+		passed = passed && index && index->size() == 0 && !index->find(7) && index->position(7) == 0 && !index->hasPayloads();
+	}
+	{
+		MappedIndexBuilder<std::uint64_t> builder;
+		builder.add(42);
+		passed = passed && builder.write(index_path);
+		const auto index = MappedIndex<std::uint64_t>::open(index_path);
+		passed = passed && index && matches_in_memory(*index, {42}, {0, 41, 42, 43});
+	}
+	{
+		std::mt19937_64 gen(2);
+		auto keys = make_keys(100000, 1000, gen);
+		std::shuffle(keys.begin(), keys.end(), gen);
+		MappedIndexBuilder<std::uint64_t> builder;
+		for(const auto key : keys)
+		{
+			builder.add(key);
+		}
+		passed = passed && builder.write(index_path);
+		std::sort(keys.begin(), keys.end());
+		std::vector<std::uint64_t> targets = {0, std::numeric_limits<std::uint64_t>::max()};
+		for(std::size_t i = 0; i < keys.size(); i += 7)
+		{
+			targets.push_back(keys[i]);
+			targets.push_back(keys[i] + 1);
+		}
+		const auto index = MappedIndex<std::uint64_t>::open(index_path);
+		passed = passed && index && !index->hasPayloads() && index->payload(0).empty() && matches_in_memory(*index, keys, targets);
+	}
+	{
+		const std::vector<double> keys = {-2.5, 0.0, 0.125, 3.0, 1e300};
+		MappedIndexBuilder<double> builder;
+		for(auto it = keys.rbegin(); it != keys.rend(); ++it)
+		{
+			builder.add(*it, std::to_string(*it));
+		}
+		passed = passed && builder.write(index_path);
+		const auto index = MappedIndex<double>::open(index_path);
+		passed = passed && index && matches_in_memory(*index, keys, {-3.0, -2.5, 0.1, 0.125, 2.0, 3.0, 1e301});
+		passed = passed && index && index->payload(*index->find(3.0)) == std::to_string(3.0);
+	}
+	std::remove(index_path.c_str());
+	std::cout << "Test 2 (key kinds and sizes): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 3: Files that aren't a valid index of the requested key type are refused
+void test_invalid_files()
+{
+	MappedIndexBuilder<std::uint32_t> builder;
+	for(std::uint32_t k = 0; k < 1000; k++)
+	{
+		builder.add(k * 3, "payload");
+	}
+
+	bool passed = !MappedIndex<std::uint32_t>::open("/tmp/mapped_index_missing.idx");
+	passed = passed && builder.write(index_path) && MappedIndex<std::uint32_t>::open(index_path);
+	// Wrong width, wrong signedness
+	passed = passed && !MappedIndex<std::uint64_t>::open(index_path) && !MappedIndex<std::int32_t>::open(index_path) && !MappedIndex<float>::open(index_path);
+
+	const std::uint32_t version = mappedIndexVersion + 1;
+	patch_file(index_path, offsetof(MappedIndexHeader, version), &version, sizeof(version));
+	passed = passed && !MappedIndex<std::uint32_t>::open(index_path);
+
+	passed = passed && builder.write(index_path);
+	patch_file(index_path, 0, "NOTANIDX", 8);
+	passed = passed && !MappedIndex<std::uint32_t>::open(index_path);
+
+	// Key count running past the end of the file
+	passed = passed && builder.write(index_path);
+	const std::uint64_t count = 1u << 30;
+	patch_file(index_path, offsetof(MappedIndexHeader, count), &count, sizeof(count));
+	passed = passed && !MappedIndex<std::uint32_t>::open(index_path);
+
+	// Last payload offset pointing outside the payload bytes
+	passed = passed && builder.write(index_path);
+	auto index = MappedIndex<std::uint32_t>::open(index_path);
+	if(index)
+	{
+		const auto lastOffset = static_cast<std::size_t>(alignUp(sizeof(MappedIndexHeader), 64) + alignUp(1000 * sizeof(std::uint32_t), 8)) + 1000 * sizeof(std::uint64_t);
+		index.reset();
+		const std::uint64_t bad = 1u << 20;
+		patch_file(index_path, lastOffset, &bad, sizeof(bad));
+		passed = passed && !MappedIndex<std::uint32_t>::open(index_path);
+	}
+
+	// Truncated file
+	passed = passed && builder.write(index_path) && truncate(index_path.c_str(), 100) == 0 && !MappedIndex<std::uint32_t>::open(index_path);
+	passed = passed && truncate(index_path.c_str(), 10) == 0 && !MappedIndex<std::uint32_t>::open(index_path);
+	std::remove(index_path.c_str());
+	std::cout << "Test 3 (invalid files): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 4: Open time and lookup speed of a 1 GiB index against searching the keys in memory
+void test_open_and_lookup_speed()
+{
+	std::mt19937_64 gen(4);
+	const std::size_t n = std::size_t{1} << 27;
+	bool passed = true;
+	std::vector<std::uint64_t> keys = make_keys(n, 1000, gen);
+	auto start = std::chrono::steady_clock::now();
+	{
+		MappedIndexBuilder<std::uint64_t> builder;
+		builder.reserve(n);
+		for(const auto key : keys)
+		{
+			builder.add(key);
+		}
+		passed = builder.write(index_path);
+	}
+	const auto buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Built " << (n * sizeof(std::uint64_t) >> 20) << " MiB index in " << buildTime << " s" << std::endl;
+
+	std::vector<std::uint64_t> targets(2000000);
+	for(auto &t : targets)
+	{
+		t = keys[gen() % n] + gen() % 2; // Half hits, half misses
+	}
+
+	for(const bool populate : {false, true})
+	{
+		start = std::chrono::steady_clock::now();
+		const auto index = MappedIndex<std::uint64_t>::open(index_path, MapOptions{populate, true, true});
+		const auto openTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(!index)
+		{
+			passed = false;
+			break;
+		}
+
+		std::size_t mappedHits = 0;
+		std::size_t mismatches = 0;
+		start = std::chrono::steady_clock::now();
+		for(const auto target : targets)
+		{
+			mappedHits += index->find(target).has_value();
+		}
+		const auto mappedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::size_t memoryHits = 0;
+		start = std::chrono::steady_clock::now();
+		for(const auto target : targets)
+		{
+			auto it = binary_search_position(keys.begin(), keys.end(), target);
+			memoryHits += it != keys.end() && *it == target;
+		}
+		const auto memoryTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for(std::size_t i = 0; i < targets.size(); i += 97)
+		{
+			mismatches += index->position(targets[i]) != static_cast<std::size_t>(binary_search_position(keys.begin(), keys.end(), targets[i]) - keys.begin());
+		}
+		passed = passed && mappedHits == memoryHits && mismatches == 0;
+		std::cout << (populate ? "Populated" : "Lazy") << " open: " << openTime << " ms, " << targets.size() << " lookups mapped " << mappedTime << " s, in memory " << memoryTime << " s" << std::endl;
+	}
+	std::remove(index_path.c_str());
+	std::cout << "Test 4 (open and lookup speed): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+int main()
+{
+	std::cout << "Mapped index tests started" << std::endl;
+
+	test_round_trip();
+	test_key_kinds();
+	test_invalid_files();
+	test_open_and_lookup_speed();
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+// Hardware performance counters around benchmark runs, read through Linux perf_event_open
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <optional>
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfEvent
+{
+	perfCycles,
+	perfInstructions,
+	perfBranchMisses,
+	perfL1dMisses,
+	perfLlcMisses,
+	perfDtlbMisses,
+	perfEventCount
+};
+
+// Cycles, instructions, branch misses and L1D, LLC and dTLB read misses of the calling thread between
+// start() and stop(), user space only. Each counter is opened on its own, so one the CPU or kernel
+// doesn't offer (common in containers and VMs) just reads as missing and the rest still work.
+// Counts are scaled up when the kernel had to multiplex counters.
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+		fds.fill(-1);
+#ifdef __linux__
+		const std::uint64_t cacheReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const std::array<std::pair<std::uint32_t, std::uint64_t>, perfEventCount> events = {{
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cacheReadMiss},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cacheReadMiss},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cacheReadMiss}
+		}};
+		for(std::size_t e = 0; e < perfEventCount; e++)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[e].first;
+			attr.config = events[e].second;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters &) = delete;
+	PerfCounters &operator=(const PerfCounters &) = delete;
+
+	~PerfCounters()
+	{
+#ifdef __linux__
+		for(const auto fd : fds)
+		{
+			if(fd >= 0)
+			{
+				close(fd);
+			}
+		}
+#endif
+	}
+
+	// False if no counter could be opened at all
+	bool available() const
+	{
+		for(const auto fd : fds)
+		{
+			if(fd >= 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void start()
+	{
+#ifdef __linux__
+		for(const auto fd : fds)
+		{
+			if(fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	void stop()
+	{
+#ifdef __linux__
+		for(std::size_t e = 0; e < perfEventCount; e++)
+		{
+			counts[e].reset();
+			if(fds[e] < 0)
+			{
+				continue;
+			}
+			ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+			std::uint64_t values[3]; // Count, time enabled, time running
+			if(read(fds[e], values, sizeof(values)) == static_cast<ssize_t>(sizeof(values)) && values[2] > 0)
+			{
+				counts[e] = static_cast<double>(values[0]) * values[1] / values[2];
+			}
+		}
+#endif
+	}
+
+	// Count from the last start/stop pair, empty if that counter isn't available
+	std::optional<double> count(const PerfEvent event) const
+	{
+		return counts[event];
+	}
+
+	// Every counter divided by units, e.g. "cycles 41.2, instructions 57.9, ... per element"
+	std::string report(const double units, const char *unitName) const
+	{
+		static const char *names[perfEventCount] = {"cycles", "instructions", "branch-misses", "L1D misses", "LLC misses", "dTLB misses"};
+		if(!available())
+		{
+			return "performance counters unavailable";
+		}
+		std::ostringstream out;
+		for(std::size_t e = 0; e < perfEventCount; e++)
+		{
+			out << (e ? ", " : "") << names[e] << ' ';
+			if(counts[e])
+			{
+				out << *counts[e] / units;
+			}
+			else
+			{
+				out << "n/a";
+			}
+		}
+		out << " per " << unitName;
+		return out.str();
+	}
+
+private:
+	std::array<int, perfEventCount> fds;
+	std::array<std::optional<double>, perfEventCount> counts;
+};
+
+#endif
@@ -2,35 +2,105 @@
 #include <iostream>
 #include <vector>
 #include <list>
+#include <map>
 #include <cassert>
 #include <algorithm>
+#include <optional>
+#include <chrono>
+#include <random>
+#include <array>
+#include <new>
+#include <cstdlib>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <functional>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <thread>
+#include "SortContext.h"
+#include "SortTuning.h"
+#include "PerfCounters.h"
+
+// Tuning key and defaults for qs, see SortTuning.h
+struct QuickSortEngine
+{
+	static constexpr const char *name = "quickSort";
+	static constexpr SortTuning defaults() { return {11, neverSample, 65536}; }
+};
+
+// Thresholds for qs on T. Constant evaluation can't read the cache file, so a sort done at compile
+// time (C++20) uses the defaults.
+template<typename T>
+constexpr SortTuning quickSortTuning()
+{
+#ifdef __cpp_lib_is_constant_evaluated
+	if(std::is_constant_evaluated())
+	{
+		return QuickSortEngine::defaults();
+	}
+#endif
+	return sortTuning<QuickSortEngine, T>();
+}
 
 // Function prototypes
 template<typename Iter>
-void quickSort(Iter begin, Iter end);
+constexpr void quickSort(Iter begin, Iter end);
 
 template<typename Iter>
-void qs(Iter begin, Iter end);
+constexpr void qs(Iter begin, Iter end);
+
+template <typename Iter>
+constexpr Iter Partition(Iter begin, Iter end);
 
 template <typename Iter>
-Iter Partition(Iter begin, Iter end);
+constexpr Iter medianOf3(Iter begin, Iter end);
 
 template <typename Iter>
-Iter medianOf3(Iter begin, Iter end);
+constexpr Iter medianOf9(Iter begin, Iter end);
 
 template<typename Iter>
-void insertionSort(Iter begin, Iter end);
+constexpr void insertionSort(Iter begin, Iter end);
 
 template <typename Iter>
-void sort2(Iter begin, Iter end);
+constexpr void sort2(Iter begin, Iter end);
 
 template <typename Iter>
-void sort3(Iter begin, Iter end);
+constexpr void sort3(Iter begin, Iter end);
+
+template<typename Iter>
+void dualPivotQuickSort(Iter begin, Iter end);
+
+template<typename Iter>
+void dpqs(Iter low, Iter high);
+
+template<typename Iter>
+bool sortPivotSample(Iter low, Iter high);
+
+template<typename Iter>
+std::array<std::pair<Iter, Iter>, 3> dualPivotPartition(Iter low, Iter high);
+
+template<typename Iter>
+std::array<std::pair<Iter, Iter>, 3> equalPivotPartition(Iter low, Iter high);
+
+template<typename T>
+void quickSort(std::list<T> &lst);
+
+template<typename T>
+void quickSort(std::list<T> &lst, SortContext &ctx);
+
+template<typename T>
+void listMergeSort(std::list<T> &lst, SortContext &ctx);
 
 
 //Wrapper function to account for std::end returning past the end iterator
+// The first sort of each element type looks up its thresholds, and the first sort in the process reads
+// the tuning cache file from the working directory (see SortTuningCache)
 template<typename Iter>
-void quickSort(Iter begin, Iter end)
+constexpr void quickSort(Iter begin, Iter end)
 {
 	if(begin == end) return; // Empty vector
 	qs(begin, std::prev(end));
@@ -38,11 +108,12 @@ void quickSort(Iter begin, Iter end)
 
 // Sorts a range of elements using the Quick Sort algorithm.
 template<typename Iter>
-void qs(Iter begin, Iter end)
+constexpr void qs(Iter begin, Iter end)
 {
+	const auto tuning = quickSortTuning<typename std::iterator_traits<Iter>::value_type>();
 	while(std::distance(begin, end) > 0)
 	{
-		if (std::distance(begin, end) < 11)
+		if (static_cast<std::size_t>(std::distance(begin, end)) < tuning.insertionCutoff)
 		{
 			if (std::distance(begin, end) == 2) // More efficient to manually sort 2 or 3 elements than recurse
 			{
@@ -80,11 +151,12 @@ void qs(Iter begin, Iter end)
 
 // Partition function for Quicksort
 template <typename Iter>
-Iter Partition(Iter begin, Iter end)
+constexpr Iter Partition(Iter begin, Iter end)
 {
 	Iter lft = begin; // Initialize left index
 	Iter rgt = end; // Initialize right index
-	auto pivot = *medianOf3(lft, rgt);
+	const auto tuning = quickSortTuning<typename std::iterator_traits<Iter>::value_type>();
+	auto pivot = static_cast<std::size_t>(std::distance(lft, rgt)) >= tuning.pivotSampleCutoff ? *medianOf9(lft, rgt) : *medianOf3(lft, rgt);
 
 	while(true) 
 	{
@@ -119,7 +191,7 @@ Iter Partition(Iter begin, Iter end)
 // @return Median value among the first, middle and last elements and sorts them into ascending order
 // @param end Points to the last element, not one after the last (which std::end() does)
 template <typename Iter>
-Iter medianOf3(Iter begin, Iter end)
+constexpr Iter medianOf3(Iter begin, Iter end)
 {
 	// General formula for mid point is [begin + (end - begin) / 2]
 	Iter mid = std::next(begin, std::distance(begin, end) / 2);
@@ -139,11 +211,31 @@ Iter medianOf3(Iter begin, Iter end)
 	return mid;
 }
 
+// Tukey's ninther: the median of the medians of three spread out triples, a better pivot estimate on large ranges.
+// The winner is moved to the middle and medianOf3 then puts the first and last elements in order, so
+// Partition still gets the sentinels it relies on.
+template <typename Iter>
+constexpr Iter medianOf9(Iter begin, Iter end)
+{
+	const auto step = std::distance(begin, end) / 8;
+	assert(step > 0);
+	Iter mid = std::next(begin, std::distance(begin, end) / 2);
+	Iter lo = medianOf3(begin, std::next(begin, 2 * step));
+	Iter md = medianOf3(std::prev(mid, step), std::next(mid, step));
+	Iter hi = medianOf3(std::prev(end, 2 * step), end);
+	// Median of the three medians
+	if(*lo > *hi) std::swap(lo, hi);
+	if(*lo > *md) std::swap(lo, md);
+	if(*md > *hi) std::swap(md, hi);
+	std::iter_swap(md, mid);
+	return medianOf3(begin, end);
+}
+
 // Insertion sort is effective on small ranges
 template<typename Iter>
-void insertionSort(Iter begin, Iter end)
+constexpr void insertionSort(Iter begin, Iter end)
 {
-	assert(std::distance(begin, end) > 2 && std::distance(begin, end) < 11);
+	assert((std::distance(begin, end) > 2 && static_cast<std::size_t>(std::distance(begin, end)) < quickSortTuning<typename std::iterator_traits<Iter>::value_type>().insertionCutoff));
 	for(auto i = std::next(begin); i != std::next(end); std::advance(i, 1))
 	{
 		std::rotate(std::upper_bound(begin, i, *i), i, std::next(i));
@@ -152,7 +244,7 @@ void insertionSort(Iter begin, Iter end)
 
 // Manually sort 2 elements into ascending order
 template <typename Iter>
-void sort2(Iter begin, Iter end)
+constexpr void sort2(Iter begin, Iter end)
 {
 	//std::advance(end, -1);
 	if(*end < *begin)
@@ -164,7 +256,7 @@ void sort2(Iter begin, Iter end)
 
 // Manually sort 3 elements into ascending order
 template <typename Iter>
-void sort3(Iter begin, Iter end)
+constexpr void sort3(Iter begin, Iter end)
 {
 	auto mid = std::next(begin);
 	assert(std::next(mid) == end);
@@ -183,184 +275,1895 @@ void sort3(Iter begin, Iter end)
 	assert(*begin <= *mid && *mid <= *end);
 }
 
-// Quicksort tests
-// Functional test cases
-// Test case 1: empty vector
-void testEmptyRange()
+// Dual-pivot quicksort (Yaroslavskiy): two pivots split each range into < p1, between, > p2 in one pass,
+// which touches every element fewer times than the one pivot of qs
+template<typename Iter>
+void dualPivotQuickSort(Iter begin, Iter end)
 {
-	std::vector<int> vec;  // Empty vector
-	quickSort(vec.begin(), (vec.end()));
-	assert(vec.size() == 0);
+	if(begin == end) return; // Empty vector
+	dpqs(begin, std::prev(end));
 }
 
-// Test case 2: vector with only one element.
-void testSingleElementRange()
+// @param high Points to the last element, like qs
+template<typename Iter>
+void dpqs(Iter low, Iter high)
 {
-	std::vector<int> vec = {42};  // Single-element vector
-	quickSort(vec.begin(), vec.end());
-	assert(vec.size() == 1);
-	assert(vec[0] == 42);
+	static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::iterator_category>::value, "dual-pivot quicksort samples by index");
+	const auto cutoff = std::max<std::ptrdiff_t>(static_cast<std::ptrdiff_t>(std::min<std::size_t>(quickSortTuning<typename std::iterator_traits<Iter>::value_type>().insertionCutoff, 1 << 20)), 7);
+	while(high - low >= cutoff)
+	{
+		auto parts = sortPivotSample(low, high) ? dualPivotPartition(low, high) : equalPivotPartition(low, high);
+		// Recurse on the two smaller parts and loop on the largest
+		std::sort(parts.begin(), parts.end(), [](const std::pair<Iter, Iter> &a, const std::pair<Iter, Iter> &b) { return a.second - a.first < b.second - b.first; });
+		for(std::size_t p = 0; p < 2; p++)
+		{
+			if(parts[p].second - parts[p].first > 1)
+			{
+				dpqs(parts[p].first, std::prev(parts[p].second));
+			}
+		}
+		if(parts[2].second - parts[2].first < 2)
+		{
+			return;
+		}
+		low = parts[2].first;
+		high = std::prev(parts[2].second);
+	}
+	if(high - low > 0)
+	{
+		qs(low, high); // Small ranges go to the base cases of qs
+	}
 }
 
-// Test case 3: vector where elements are already sorted
-void testSortedRange()
+// Sorts five elements spread around the middle of [low, high] in place, extending medianOf3 to a
+// sample that yields two pivots: the 2nd and 4th smallest go to low and high.
+// @return false if those two are equal, then the median is at low and the range needs equalPivotPartition
+template<typename Iter>
+bool sortPivotSample(Iter low, Iter high)
 {
-	std::vector<int> vec = {1, 2, 3, 4, 5};  // Sorted vector
-	quickSort(vec.begin(), vec.end());
-	assert((vec == std::vector<int>{1, 2, 3, 4, 5}));
+	const auto seventh = (high - low + 1) / 7;
+	std::array<Iter, 5> e;
+	e[2] = low + (high - low) / 2;
+	e[1] = e[2] - seventh;
+	e[0] = e[1] - seventh;
+	e[3] = e[2] + seventh;
+	e[4] = e[3] + seventh;
+	for(std::size_t i = 1; i < e.size(); i++)
+	{
+		for(std::size_t j = i; j > 0 && *e[j] < *e[j - 1]; j--)
+		{
+			std::iter_swap(e[j], e[j - 1]);
+		}
+	}
+	if(*e[1] < *e[3])
+	{
+		std::iter_swap(e[1], low);
+		std::iter_swap(e[3], high);
+		return true;
+	}
+	std::iter_swap(e[2], low);
+	return false;
 }
 
-// Test case 4: vector where elements are sorted in descending order.
-void testReverseSortedRange()
+// Partitions [low, high] around p1 = *low and p2 = *high, p1 < p2. Pivots end up in their final places.
+// @return The parts still to sort as [first, last) ranges: < p1, between the pivots, > p2
+template<typename Iter>
+std::array<std::pair<Iter, Iter>, 3> dualPivotPartition(Iter low, Iter high)
 {
-	std::vector<int> vec = {5, 4, 3, 2, 1};  // Reverse-sorted vector
-	quickSort(vec.begin(), vec.end());
-	assert((vec == std::vector<int>{1, 2, 3, 4, 5}));
+	const auto p1 = *low;
+	const auto p2 = *high;
+	Iter less = std::next(low); // Everything before less is < p1
+	Iter great = std::prev(high); // Everything after great is > p2
+	for(Iter k = less; k <= great; k++)
+	{
+		if(*k < p1)
+		{
+			std::iter_swap(k, less);
+			less++;
+		}
+		else if(p2 < *k)
+		{
+			while(p2 < *great && k < great)
+			{
+				great--;
+			}
+			std::iter_swap(k, great);
+			great--;
+			if(*k < p1)
+			{
+				std::iter_swap(k, less);
+				less++;
+			}
+		}
+	}
+	const Iter leftEnd = std::prev(less);
+	const Iter rightBegin = std::next(great, 2);
+	std::iter_swap(low, leftEnd);
+	std::iter_swap(high, std::next(great));
+
+	// A big middle part usually means many copies of the pivots, gather them next to the pivots so
+	// they're out of the next round
+	if(great - less > (high - low) / 2)
+	{
+		for(Iter k = less; k <= great; k++)
+		{
+			if(!(p1 < *k))
+			{
+				std::iter_swap(k, less);
+				less++;
+			}
+			else if(!(*k < p2))
+			{
+				while(!(*great < p2) && k < great)
+				{
+					great--;
+				}
+				std::iter_swap(k, great);
+				great--;
+				if(!(p1 < *k))
+				{
+					std::iter_swap(k, less);
+					less++;
+				}
+			}
+		}
+	}
+	return {{{low, leftEnd}, {less, std::next(great)}, {rightBegin, std::next(high)}}};
 }
 
-// Test case 5: vector with random ints
-void testRandomdRangeInt()
+// Three way partition of [low, high] around p = *low for samples whose pivots tie. Every copy of p is
+// done after this pass, so runs of equal elements can't make the sort quadratic.
+// @return The parts still to sort as [first, last) ranges: < p, an empty middle, > p
+template<typename Iter>
+std::array<std::pair<Iter, Iter>, 3> equalPivotPartition(Iter low, Iter high)
 {
-	std::vector<int> vec = {3, 1, 4, -2, 5};  // Random vector
-	quickSort(vec.begin(), vec.end());
-	assert((vec == std::vector<int>{-2, 1, 3, 4, 5}));
+	const auto pivot = *low;
+	Iter lt = low;
+	Iter eq = low;
+	Iter gt = high;
+	while(eq <= gt)
+	{
+		if(*eq < pivot)
+		{
+			std::iter_swap(eq, lt);
+			lt++;
+			eq++;
+		}
+		else if(pivot < *eq)
+		{
+			std::iter_swap(eq, gt);
+			gt--;
+		}
+		else
+		{
+			eq++;
+		}
+	}
+	return {{{low, lt}, {eq, eq}, {eq, std::next(high)}}};
 }
 
-// Test case 6: vector with random chars
-void testRandomRangeChar()
+// Lists are sorted by relinking nodes, partitioning a list through iterators walks it several
+// times per level and swaps values instead of moving nodes
+template<typename T>
+void quickSort(std::list<T> &lst)
 {
-	std::vector<char> vec = {'c', 'b', 'a', 'z', 'x', 'y'};  // Random vector
-	quickSort(vec.begin(), vec.end());
-	assert((vec == std::vector<char>{'a', 'b', 'c', 'x', 'y', 'z'}));
+	listMergeSort(lst, threadSortContext());
 }
 
-// Test case 7: vector with random ints and duplicates
-void testDuplicateElements()
+template<typename T>
+void quickSort(std::list<T> &lst, SortContext &ctx)
 {
-	std::vector<int> vec = {3, 1, 4, 2, 1, 5, 4};  // Vector with duplicates
-	quickSort(vec.begin(), vec.end());
-	assert((vec == std::vector<int>{1, 1, 2, 3, 4, 4, 5}));
+	listMergeSort(lst, ctx);
 }
 
-// Test case 8: vector with all duplicates, odd length
-void allDupsOdd()
+// Bottom-up natural merge sort that only relinks nodes, elements are never copied, moved or swapped.
+// Ascending runs are taken as they are and strictly descending runs are reversed, then runs are
+// combined like a binary counter: levels[i] is either empty or holds about 2^i runs.
+template<typename T>
+void listMergeSort(std::list<T> &lst, SortContext &ctx)
 {
-	std::vector<int> vec(5, 10);  // Odd length vector of duplicates
-	quickSort(vec.begin(), vec.end());
-	assert(vec == std::vector<int>(5, 10));
+	SortContext::Scope scope(ctx);
+	ScratchVector<std::list<T>> levels{ArenaAllocator<std::list<T>>(ctx)};
+	levels.reserve(64); // One level per bit of the run count
+	std::list<T> run;
+	while(!lst.empty())
+	{
+		auto runEnd = std::next(lst.begin());
+		if(runEnd != lst.end() && *runEnd < *lst.begin())
+		{
+			while(runEnd != lst.end() && *runEnd < *std::prev(runEnd))
+			{
+				runEnd++;
+			}
+			run.splice(run.end(), lst, lst.begin(), runEnd);
+			run.reverse();
+		}
+		else
+		{
+			while(runEnd != lst.end() && !(*runEnd < *std::prev(runEnd)))
+			{
+				runEnd++;
+			}
+			run.splice(run.end(), lst, lst.begin(), runEnd);
+		}
+		
+		// Carry the run up through the occupied levels, earlier elements always stay in front so the sort is stable
+		typename std::vector<std::list<T>>::size_type level = 0;
+		for(; level < levels.size() && !levels[level].empty(); level++)
+		{
+			levels[level].merge(run);
+			run.swap(levels[level]);
+		}
+		if(level == levels.size())
+		{
+			levels.emplace_back();
+		}
+		run.swap(levels[level]);
+	}
+	
+	// Higher levels hold earlier elements
+	for(auto &pending : levels)
+	{
+		pending.merge(run);
+		run.swap(pending);
+	}
+	lst.swap(run);
 }
 
-// Test case 9: vector with all duplicates, even length
-void allDupsEven()
+// Quicksort that can be paused and resumed, for callers that can't block for the whole sort.
+// The recursion in qs is replaced by an explicit stack of pending ranges and Partition is broken
+// into resumable scan steps, so a slice never does more than its budget of element visits.
+template<typename Iter>
+class ResumableQuickSort
 {
-	std::vector<int> vec(6, 10);  // Even length vector of duplicates
-	quickSort(vec.begin(), vec.end());
-	assert(vec == std::vector<int>(6, 10));
-}
+public:
+	ResumableQuickSort(Iter begin, Iter end);
+	
+	// Visit at most elementBudget elements, returns true once the sort has finished or was cancelled
+	bool resume(std::size_t elementBudget);
+	
+	// Keep resuming in small slices until timeBudget has elapsed, returns true once finished or cancelled
+	template<typename Rep, typename Period>
+	bool resumeFor(const std::chrono::duration<Rep, Period> &timeBudget);
+	
+	// Stop the sort, the range is left as a permutation of the input
+	void cancel();
+	
+	bool cancelled() const;
+	
+	// Fraction of elements already in their final position
+	double progress() const;
+	
+private:
+	enum class Phase { Idle, ScanLeft, ScanRight, Exchange };
+	
+	// Same split as qs, smaller side is pushed last so it's sorted first and the stack stays O(log n)
+	void finishPartition();
+	
+	// Queue an inclusive range, empty ones are dropped
+	void push(Iter first, Iter last);
+	
+	// Element budget of each resume() call in resumeFor, which reads the clock between calls. Small enough
+	// that overrunning the deadline by one slice costs microseconds, large enough to keep clock reads rare.
+	static constexpr std::size_t sliceElements = 4096;
+	
+	// Inclusive ranges like qs. Smaller side first bounds the depth by log2(n) + 1, so a fixed
+	// stack covers any input and the sort never allocates.
+	std::array<std::pair<Iter, Iter>, 2 * 64 + 2> pending;
+	std::size_t pendingCount = 0;
+	Phase phase = Phase::Idle;
+	Iter low, high, lft, rgt;
+	std::optional<typename std::iterator_traits<Iter>::value_type> pivot;
+	std::size_t total = 0;
+	std::size_t finished = 0;
+	bool stopped = false;
+};
 
-// Test case 10: list with random ints
-void testRandomListSort()
+template<typename Iter>
+ResumableQuickSort<Iter>::ResumableQuickSort(Iter begin, Iter end)
 {
-	std::list<int> randomList = {30, 10, 50, 20, 40}; // Random list
-	quickSort(randomList.begin(), randomList.end());
-	assert((randomList == std::list<int>{10, 20, 30, 40, 50}));
+	total = std::distance(begin, end);
+	if(begin != end)
+	{
+		push(begin, std::prev(end));
+	}
 }
 
-// Quicksort tests
-// Stress Test Cases
-// Test 1: large vector with random longs
-void testLongRand()
+template<typename Iter>
+bool ResumableQuickSort<Iter>::resume(std::size_t elementBudget)
 {
-	std::vector<long> vec;
-	vec.reserve(50010000); // Reserve memory for efficiency
-	for(size_t i = -10000; i <= 50000000; i++)
+	while(elementBudget > 0 && !stopped)
 	{
-	  if(i % 5 == 0) vec.push_back(i - 20);
-	  else if(i % 3 == 0) vec.push_back(i + 20);
-	  else if(i % 7 == 0) vec.push_back(i + 1);
-	  else vec.push_back(i);
+		switch(phase)
+		{
+			case Phase::Idle:
+			{
+				if(pendingCount == 0)
+				{
+					return true;
+				}
+				pendingCount--;
+				low = pending[pendingCount].first;
+				high = pending[pendingCount].second;
+				const auto distance = std::distance(low, high);
+				if(static_cast<std::size_t>(distance) < sortTuning<QuickSortEngine, typename std::iterator_traits<Iter>::value_type>().insertionCutoff)
+				{
+					if(distance == 2) sort3(low, high);
+					else if(distance == 1) sort2(low, high);
+					else if(distance > 2) insertionSort(low, high);
+					finished += distance + 1;
+					elementBudget -= std::min<std::size_t>(elementBudget, distance + 1);
+					break;
+				}
+				pivot = static_cast<std::size_t>(distance) >= sortTuning<QuickSortEngine, typename std::iterator_traits<Iter>::value_type>().pivotSampleCutoff ? *medianOf9(low, high) : *medianOf3(low, high);
+				lft = low;
+				rgt = high;
+				phase = Phase::ScanLeft;
+				break;
+			}
+			case Phase::ScanLeft:
+				while(elementBudget > 0 && *lft < *pivot)
+				{
+					lft++;
+					elementBudget--;
+				}
+				if(!(*lft < *pivot))
+				{
+					phase = Phase::ScanRight;
+				}
+				break;
+			case Phase::ScanRight:
+				while(elementBudget > 0 && *rgt > *pivot)
+				{
+					rgt--;
+					elementBudget--;
+				}
+				if(!(*rgt > *pivot))
+				{
+					phase = Phase::Exchange;
+				}
+				break;
+			case Phase::Exchange:
+				elementBudget--;
+				if(std::distance(lft, rgt) <= 0)
+				{
+					finishPartition();
+					break;
+				}
+				if(*lft == *rgt)
+				{
+					std::advance(lft, 1);
+				}
+				else
+				{
+					std::iter_swap(lft, rgt);
+				}
+				phase = Phase::ScanLeft;
+				break;
+		}
 	}
-	
-	quickSort(vec.begin(), vec.end());	
-	assert(std::is_sorted(vec.begin(), vec.end()));
+	return stopped || (phase == Phase::Idle && pendingCount == 0);
 }
 
-// Test 2: large vector of duplicates
-void testLongDups()
+template<typename Iter>
+template<typename Rep, typename Period>
+bool ResumableQuickSort<Iter>::resumeFor(const std::chrono::duration<Rep, Period> &timeBudget)
 {
-	std::vector<long> vec;
-	vec.reserve(100000);
-	for(size_t i = 1; i <= vec.capacity(); i++)
+	const auto deadline = std::chrono::steady_clock::now() + timeBudget;
+	while(!resume(sliceElements))
 	{
-	  vec.push_back(321);
+		if(std::chrono::steady_clock::now() >= deadline)
+		{
+			return false;
+		}
 	}
-	
-	quickSort(vec.begin(), vec.end());
-	assert(std::is_sorted(vec.begin(), vec.end()));
+	return true;
 }
 
-// Test 3: large vector in ascending order
-void testAscending()
+template<typename Iter>
+void ResumableQuickSort<Iter>::cancel()
 {
-	std::vector<int> ascendingVec;
-    ascendingVec.reserve(100000000);
+	stopped = true;
+}
 
-    for (size_t i = 1; i <= ascendingVec.capacity(); i++)
-	{
-        ascendingVec.push_back(i);
-    }
-	
-	quickSort(ascendingVec.begin(), ascendingVec.end());
-	assert(std::is_sorted(ascendingVec.begin(), ascendingVec.end()));
+template<typename Iter>
+bool ResumableQuickSort<Iter>::cancelled() const
+{
+	return stopped;
 }
 
-// Test 4: large vector in descending order
-void testDescending()
+template<typename Iter>
+double ResumableQuickSort<Iter>::progress() const
 {
-	std::vector<int> descendingVec;
-    descendingVec.reserve(100000000);
+	return total == 0 ? 1.0 : static_cast<double>(finished) / total;
+}
 
-    for (size_t i = descendingVec.capacity(); i <= 1; i--)
+template<typename Iter>
+void ResumableQuickSort<Iter>::finishPartition()
+{
+	Iter pi = rgt;
+	phase = Phase::Idle;
+	pivot.reset();
+	if(std::distance(low, pi) > std::distance(pi, high))
 	{
-        descendingVec.push_back(i);
-    }
-	
-	quickSort(descendingVec.begin(), descendingVec.end());
-	assert(std::is_sorted(descendingVec.begin(), descendingVec.end()));
+		finished++; // pi is excluded from both sides, same as qs
+		push(low, std::prev(pi));
+		push(std::next(pi), high);
+	}
+	else
+	{
+		push(std::next(pi), high);
+		push(low, pi);
+	}
 }
 
-// Test 5: large vector with adjacent elements alternating between positive and negative
-void testAlternating2()
+template<typename Iter>
+void ResumableQuickSort<Iter>::push(Iter first, Iter last)
 {
-	std::vector<int> alternatingVec;
-    alternatingVec.reserve(10000000);
-
-    for (size_t i = 1; i <= alternatingVec.capacity(); i++)
+	if(std::distance(first, last) >= 0)
 	{
-		int value = (i % 2 == 0) ? -i : i;
-		alternatingVec.push_back(value);
-    }
-	
-	quickSort(alternatingVec.begin(), alternatingVec.end());
-	assert(std::is_sorted(alternatingVec.begin(), alternatingVec.end()));
+		assert(pendingCount < pending.size());
+		pending[pendingCount++] = std::make_pair(first, last);
+	}
 }
 
-// Test 6: large vector, mostly ascending except every 10th element is negative
-void testAlternating10()
+// Sorted view over a range that only sorts as much as has been read. Each read partitions the one
+// unsorted chunk holding the requested position with Partition until the position is final, and keeps
+// the cuts it made for later reads. Reading the first k positions costs about O(n + k log k), reading
+// all of them does the same work as qs.
+template<typename Iter>
+class LazySortedView
 {
-	std::vector<int> ascendingVec;
-    ascendingVec.reserve(1000000);
-
-    for (size_t i = 1; i <= ascendingVec.capacity(); i++) {
-        int value = (i % 10 == 0) ? -i : i;
-        ascendingVec.push_back(value);
-    }
+public:
+	using value_type = typename std::iterator_traits<Iter>::value_type;
 	
-	quickSort(ascendingVec.begin(), ascendingVec.end());
-	assert(std::is_sorted(ascendingVec.begin(), ascendingVec.end()));
-}
-
-
+	class iterator;
+	
+	// The view reorders [begin, end) in place as it's read
+	LazySortedView(Iter begin, Iter end);
+	
+	// Element at position i of the sorted range
+	const value_type &operator[](std::size_t i);
+	
+	std::size_t size() const;
+	
+	// Number of leading positions that are already final
+	std::size_t sortedPrefix() const;
+	
+	iterator begin();
+	iterator end();
+	
+private:
+	// Partition the chunk around position i until i is final
+	void finalize(std::size_t i);
+	
+	// Record that everything before position c is no greater than everything from c on
+	void addCut(std::size_t c);
+	
+	// Move sortedEnd past the chunks at the front that are final
+	void advanceSortedEnd();
+	
+	// Sort every chunk that isn't yet and drop the cuts, every position is final afterwards
+	void sortRest();
+	
+	Iter first;
+	std::size_t count;
+	std::size_t sortedEnd = 0;
+	// Pending cuts above sortedEnd, each mapped to whether the chunk that ends at it is sorted already.
+	// The largest one is count, so every position has a cut above it. A chunk small enough to sort
+	// outright gets one marker instead of a cut between every element.
+	std::map<std::size_t, bool> cuts;
+};
+
+// Reads through operator[], so iterating finalizes positions one at a time
+template<typename Iter>
+class LazySortedView<Iter>::iterator
+{
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = typename LazySortedView<Iter>::value_type;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const value_type *;
+	using reference = const value_type &;
+	
+	iterator(LazySortedView *view, std::size_t index) : view(view), index(index) {}
+	
+	reference operator*() const { return (*view)[index]; }
+	pointer operator->() const { return &(*view)[index]; }
+	iterator &operator++() { index++; return *this; }
+	iterator operator++(int) { iterator previous = *this; index++; return previous; }
+	bool operator==(const iterator &other) const { return index == other.index; }
+	bool operator!=(const iterator &other) const { return index != other.index; }
+	
+private:
+	LazySortedView *view;
+	std::size_t index;
+};
+
+template<typename Iter>
+LazySortedView<Iter>::LazySortedView(Iter begin, Iter end) : first(begin), count(static_cast<std::size_t>(std::distance(begin, end)))
+{
+	static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::iterator_category>::value, "the view jumps straight to the chunk being read");
+	cuts.emplace(count, false);
+	if(count == 1)
+	{
+		sortedEnd = 1; // Only ever cut below, a single element is final from the start
+	}
+}
+
+template<typename Iter>
+const typename LazySortedView<Iter>::value_type &LazySortedView<Iter>::operator[](std::size_t i)
+{
+	assert(i < count);
+	finalize(i);
+	return first[i];
+}
+
+template<typename Iter>
+std::size_t LazySortedView<Iter>::size() const
+{
+	return count;
+}
+
+template<typename Iter>
+std::size_t LazySortedView<Iter>::sortedPrefix() const
+{
+	return sortedEnd;
+}
+
+template<typename Iter>
+typename LazySortedView<Iter>::iterator LazySortedView<Iter>::begin()
+{
+	return iterator(this, 0);
+}
+
+template<typename Iter>
+typename LazySortedView<Iter>::iterator LazySortedView<Iter>::end()
+{
+	return iterator(this, count);
+}
+
+template<typename Iter>
+void LazySortedView<Iter>::finalize(std::size_t i)
+{
+	const auto cutoff = quickSortTuning<value_type>().insertionCutoff;
+	while(i >= sortedEnd)
+	{
+		// Chunk [lo, hi) holding i: hi is the smallest cut above i, lo the largest cut at or below it
+		const auto above = cuts.upper_bound(i);
+		const std::size_t hi = above->first;
+		const std::size_t lo = above == cuts.begin() ? sortedEnd : std::prev(above)->first;
+		if(hi - lo == 1 || above->second)
+		{
+			return;
+		}
+		if(hi - lo < cutoff)
+		{
+			// Small chunk, sort it outright and mark it as a whole
+			qs(first + lo, first + (hi - 1));
+			above->second = true;
+			advanceSortedEnd();
+			return;
+		}
+		if(cuts.size() > count / cutoff)
+		{
+			// Reads have spread over most of the range, finishing it costs no more than the cuts still to come
+			sortRest();
+			return;
+		}
+		// The element Partition returns is in its final place, cut on both sides of it like qs does
+		const auto pi = static_cast<std::size_t>(std::distance(first, Partition(first + lo, first + (hi - 1))));
+		if(pi > lo)
+		{
+			addCut(pi);
+		}
+		if(pi + 1 < hi)
+		{
+			addCut(pi + 1);
+		}
+	}
+}
+
+template<typename Iter>
+void LazySortedView<Iter>::addCut(std::size_t c)
+{
+	assert(c > sortedEnd && c < count);
+	cuts.emplace(c, false);
+	advanceSortedEnd();
+}
+
+template<typename Iter>
+void LazySortedView<Iter>::sortRest()
+{
+	std::size_t lo = sortedEnd;
+	for(const auto &[hi, sorted] : cuts)
+	{
+		if(!sorted && hi - lo > 1)
+		{
+			qs(first + lo, first + (hi - 1));
+		}
+		lo = hi;
+	}
+	cuts.clear();
+	cuts.emplace(count, true);
+	sortedEnd = count;
+}
+
+template<typename Iter>
+void LazySortedView<Iter>::advanceSortedEnd()
+{
+	// Chunks of one element and sorted chunks at the front are final
+	while(cuts.begin()->first == sortedEnd + 1 || cuts.begin()->second)
+	{
+		sortedEnd = cuts.begin()->first;
+		if(sortedEnd == count)
+		{
+			break;
+		}
+		cuts.erase(cuts.begin());
+	}
+}
+
+// Keeps the k largest items of a stream in bounded memory. Items collect in a buffer of about 3k;
+// when it fills, a quickselect built on Partition keeps the k largest and remembers the smallest of
+// them as a threshold, after which most items are turned away with one comparison.
+template<typename T>
+class TopK
+{
+public:
+	explicit TopK(std::size_t k);
+	
+	void push(const T &item);
+	
+	// Batch push, keeps the threshold in a local while scanning
+	template<typename InputIt>
+	void push(InputIt first, InputIt last);
+	
+	// Take in every candidate of an accumulator that saw another part of the stream, e.g. one per thread.
+	// Merging an accumulator into itself does nothing, it has seen its part of the stream already.
+	void merge(const TopK &other);
+	
+	// The k largest items seen so far (fewer if the stream was shorter), largest first
+	std::vector<T> result() const;
+	
+	// Smallest item kept at the last compaction, empty until the buffer first fills. Only items greater
+	// than it still make it in.
+	const std::optional<T> &threshold() const;
+	
+private:
+	// Quickselect: the k largest items of buffer move to its front
+	void compact();
+	
+	std::size_t k;
+	std::size_t capacity;
+	std::vector<T> buffer;
+	std::optional<T> cutoff;
+};
+
+template<typename T>
+TopK<T>::TopK(std::size_t k) : k(k), capacity(std::max<std::size_t>(3 * k, k + 16))
+{
+	assert(k > 0);
+	buffer.reserve(capacity);
+}
+
+template<typename T>
+void TopK<T>::push(const T &item)
+{
+	if(cutoff && !(*cutoff < item))
+	{
+		return;
+	}
+	buffer.push_back(item);
+	if(buffer.size() == capacity)
+	{
+		compact();
+	}
+}
+
+template<typename T>
+template<typename InputIt>
+void TopK<T>::push(InputIt first, InputIt last)
+{
+	// Until the first compaction everything goes in, after it the cutoff only changes when compact() runs
+	for(; first != last && !cutoff; ++first)
+	{
+		buffer.push_back(*first);
+		if(buffer.size() == capacity)
+		{
+			compact();
+		}
+	}
+	if(first == last)
+	{
+		return;
+	}
+	T current = *cutoff;
+	for(; first != last; ++first)
+	{
+		if(!(current < *first))
+		{
+			continue;
+		}
+		buffer.push_back(*first);
+		if(buffer.size() == capacity)
+		{
+			compact();
+			current = *cutoff;
+		}
+	}
+}
+
+template<typename T>
+void TopK<T>::merge(const TopK &other)
+{
+	if(&other == this)
+	{
+		return; // push would append to the buffer it is reading
+	}
+	push(other.buffer.begin(), other.buffer.end());
+}
+
+template<typename T>
+std::vector<T> TopK<T>::result() const
+{
+	TopK copy = *this;
+	if(copy.buffer.size() > k)
+	{
+		copy.compact();
+	}
+	quickSort(copy.buffer.begin(), copy.buffer.end());
+	std::reverse(copy.buffer.begin(), copy.buffer.end());
+	return copy.buffer;
+}
+
+template<typename T>
+const std::optional<T> &TopK<T>::threshold() const
+{
+	return cutoff;
+}
+
+template<typename T>
+void TopK<T>::compact()
+{
+	// In ascending order the k largest start at m, narrow down on m with Partition like qs does
+	const std::size_t m = buffer.size() - k;
+	const auto smallRange = quickSortTuning<T>().insertionCutoff;
+	auto lo = buffer.begin();
+	auto hi = std::prev(buffer.end());
+	const auto target = buffer.begin() + m;
+	while(lo < hi)
+	{
+		if(static_cast<std::size_t>(std::distance(lo, hi)) < smallRange)
+		{
+			qs(lo, hi);
+			break;
+		}
+		auto pi = Partition(lo, hi); // Final place, like in qs
+		if(pi == target)
+		{
+			break;
+		}
+		if(pi < target)
+		{
+			lo = std::next(pi);
+		}
+		else
+		{
+			hi = std::prev(pi);
+		}
+	}
+	cutoff = *target;
+	buffer.erase(buffer.begin(), target);
+}
+
+// Where the key sits inside each fixed size record of a flat byte buffer
+struct RecordFormat
+{
+	std::size_t recordSize;
+	std::size_t keyOffset;
+	std::size_t keyLength;
+};
+
+// What quickSort actually moves when sorting records: 8 key bytes read as a big-endian integer, so
+// comparing integers orders keys like memcmp, and the index of the record they came from. The index
+// breaks ties, which keeps equal keys in their original order and keeps Partition away from runs of
+// equal elements.
+struct RecordKey
+{
+	std::uint64_t prefix;
+	std::uint32_t index;
+
+	bool operator<(const RecordKey &other) const { return prefix < other.prefix || (prefix == other.prefix && index < other.index); }
+	bool operator>(const RecordKey &other) const { return other < *this; }
+	bool operator<=(const RecordKey &other) const { return !(other < *this); }
+	bool operator==(const RecordKey &other) const { return prefix == other.prefix && index == other.index; }
+};
+
+// Up to 8 bytes of key starting at key as a big-endian integer, zero padded when fewer remain
+inline std::uint64_t loadKeyPrefix(const unsigned char *key, const std::size_t remaining)
+{
+	std::uint64_t prefix = 0;
+	if(remaining >= 8)
+	{
+		for(std::size_t i = 0; i < 8; i++)
+		{
+			prefix = prefix << 8 | key[i];
+		}
+		return prefix;
+	}
+	for(std::size_t i = 0; i < 8; i++)
+	{
+		prefix = prefix << 8 | (i < remaining ? key[i] : 0);
+	}
+	return prefix;
+}
+
+// Keys longer than 8 bytes: records whose prefixes tie are sorted again on the next 8 key bytes
+template<typename Iter>
+void refineRecordKeys(Iter first, Iter last, const unsigned char *records, const RecordFormat &format, const std::size_t depth)
+{
+	while(first != last)
+	{
+		const auto prefix = first->prefix;
+		auto runEnd = std::find_if(first, last, [prefix](const RecordKey &k) { return k.prefix != prefix; });
+		if(std::distance(first, runEnd) > 1)
+		{
+			for(auto k = first; k != runEnd; ++k)
+			{
+				k->prefix = loadKeyPrefix(records + k->index * format.recordSize + format.keyOffset + depth, format.keyLength - depth);
+			}
+			quickSort(first, runEnd);
+			if(depth + 8 < format.keyLength)
+			{
+				refineRecordKeys(first, runEnd, records, format, depth + 8);
+			}
+		}
+		first = runEnd;
+	}
+}
+
+// Sorts count records from in into out by their key bytes, compared like memcmp. Equal keys keep
+// their input order. Only prefixes and indices are sorted; every record is copied once, at the end.
+void sortRecords(const unsigned char *in, unsigned char *out, const std::size_t count, const RecordFormat &format, SortContext &ctx)
+{
+	assert(format.keyOffset + format.keyLength <= format.recordSize);
+	assert(count <= std::numeric_limits<std::uint32_t>::max());
+	SortContext::Scope scope(ctx);
+	ScratchVector<RecordKey> keys{ArenaAllocator<RecordKey>(ctx)};
+	keys.resize(count);
+	for(std::size_t i = 0; i < count; i++)
+	{
+		keys[i] = {loadKeyPrefix(in + i * format.recordSize + format.keyOffset, format.keyLength), static_cast<std::uint32_t>(i)};
+	}
+	quickSort(keys.begin(), keys.end());
+	if(format.keyLength > 8)
+	{
+		refineRecordKeys(keys.begin(), keys.end(), in, format, 8);
+	}
+	// Gather
+	for(std::size_t i = 0; i < count; i++)
+	{
+		std::memcpy(out + i * format.recordSize, in + keys[i].index * format.recordSize, format.recordSize);
+	}
+}
+
+// Sorts a buffer of whole records into out, which is resized to match
+void sortRecords(const std::vector<unsigned char> &in, std::vector<unsigned char> &out, const RecordFormat &format)
+{
+	assert(in.size() % format.recordSize == 0);
+	out.resize(in.size());
+	sortRecords(in.data(), out.data(), in.size() / format.recordSize, format, threadSortContext());
+}
+
+// Counts every heap allocation made by the program so tests can check the steady state makes none
+static std::size_t allocationCount = 0;
+
+void *operator new(std::size_t bytes)
+{
+	allocationCount++;
+	if(void *p = std::malloc(bytes ? bytes : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+// GCC can't see that operator new above is the replacement that pairs with this free and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Quicksort tests
+// Functional test cases
+// Test case 1: empty vector
+void testEmptyRange()
+{
+	std::vector<int> vec;  // Empty vector
+	quickSort(vec.begin(), (vec.end()));
+	assert(vec.size() == 0);
+}
+
+// Test case 2: vector with only one element.
+void testSingleElementRange()
+{
+	std::vector<int> vec = {42};  // Single-element vector
+	quickSort(vec.begin(), vec.end());
+	assert(vec.size() == 1);
+	assert(vec[0] == 42);
+}
+
+// Test case 3: vector where elements are already sorted
+void testSortedRange()
+{
+	std::vector<int> vec = {1, 2, 3, 4, 5};  // Sorted vector
+	quickSort(vec.begin(), vec.end());
+	assert((vec == std::vector<int>{1, 2, 3, 4, 5}));
+}
+
+// Test case 4: vector where elements are sorted in descending order.
+void testReverseSortedRange()
+{
+	std::vector<int> vec = {5, 4, 3, 2, 1};  // Reverse-sorted vector
+	quickSort(vec.begin(), vec.end());
+	assert((vec == std::vector<int>{1, 2, 3, 4, 5}));
+}
+
+// Test case 5: vector with random ints
+void testRandomdRangeInt()
+{
+	std::vector<int> vec = {3, 1, 4, -2, 5};  // Random vector
+	quickSort(vec.begin(), vec.end());
+	assert((vec == std::vector<int>{-2, 1, 3, 4, 5}));
+}
+
+// Test case 6: vector with random chars
+void testRandomRangeChar()
+{
+	std::vector<char> vec = {'c', 'b', 'a', 'z', 'x', 'y'};  // Random vector
+	quickSort(vec.begin(), vec.end());
+	assert((vec == std::vector<char>{'a', 'b', 'c', 'x', 'y', 'z'}));
+}
+
+// Test case 7: vector with random ints and duplicates
+void testDuplicateElements()
+{
+	std::vector<int> vec = {3, 1, 4, 2, 1, 5, 4};  // Vector with duplicates
+	quickSort(vec.begin(), vec.end());
+	assert((vec == std::vector<int>{1, 1, 2, 3, 4, 4, 5}));
+}
+
+// Test case 8: vector with all duplicates, odd length
+void allDupsOdd()
+{
+	std::vector<int> vec(5, 10);  // Odd length vector of duplicates
+	quickSort(vec.begin(), vec.end());
+	assert(vec == std::vector<int>(5, 10));
+}
+
+// Test case 9: vector with all duplicates, even length
+void allDupsEven()
+{
+	std::vector<int> vec(6, 10);  // Even length vector of duplicates
+	quickSort(vec.begin(), vec.end());
+	assert(vec == std::vector<int>(6, 10));
+}
+
+// Test case 10: list with random ints
+void testRandomListSort()
+{
+	std::list<int> randomList = {30, 10, 50, 20, 40}; // Random list
+	quickSort(randomList.begin(), randomList.end());
+	assert((randomList == std::list<int>{10, 20, 30, 40, 50}));
+}
+
+// Element that can't be copied, moved or swapped, so sorting it must relink nodes
+struct Pinned
+{
+	explicit Pinned(int v) : value(v) {}
+	Pinned(const Pinned &) = delete;
+	Pinned &operator=(const Pinned &) = delete;
+	bool operator<(const Pinned &other) const { return value < other.value; }
+	int value;
+};
+
+// Test case 11: list sort relinks nodes instead of copying elements
+void testListRelinkOnly()
+{
+	std::list<Pinned> pinnedList;
+	for(const int v : {7, 3, 9, 1, 3, 8, 2, 6, 5, 4, 0, 11, 10})
+	{
+		pinnedList.emplace_back(v);
+	}
+	std::vector<const Pinned *> addresses;
+	for(const auto &p : pinnedList)
+	{
+		addresses.push_back(&p);
+	}
+	quickSort(pinnedList);
+	assert(pinnedList.size() == addresses.size());
+	assert(std::is_sorted(pinnedList.begin(), pinnedList.end()));
+	for(const auto &p : pinnedList)
+	{
+		assert(std::find(addresses.begin(), addresses.end(), &p) != addresses.end());
+	}
+}
+
+// Test case 12: list sort keeps equal elements in their original order
+void testListStable()
+{
+	std::list<std::pair<int, int>> pairs = {{2, 0}, {1, 1}, {2, 2}, {1, 3}, {0, 4}, {2, 5}, {5, 6}, {4, 7}, {3, 8}, {1, 9}};
+	struct ByFirst
+	{
+		std::pair<int, int> p;
+		bool operator<(const ByFirst &other) const { return p.first < other.p.first; }
+	};
+	std::list<ByFirst> byFirst;
+	for(const auto &p : pairs)
+	{
+		byFirst.push_back(ByFirst{p});
+	}
+	quickSort(byFirst);
+	std::vector<int> order;
+	for(const auto &b : byFirst)
+	{
+		order.push_back(b.p.second);
+	}
+	assert((order == std::vector<int>{4, 1, 3, 9, 0, 2, 5, 8, 7, 6}));
+}
+
+// Test case 13: list sort on empty, single, ascending and descending lists
+void testListEdgeCases()
+{
+	std::list<int> empty;
+	quickSort(empty);
+	assert(empty.empty());
+	
+	std::list<int> single = {42};
+	quickSort(single);
+	assert((single == std::list<int>{42}));
+	
+	std::list<int> ascending = {1, 2, 3, 4, 5, 6};
+	quickSort(ascending);
+	assert((ascending == std::list<int>{1, 2, 3, 4, 5, 6}));
+	
+	std::list<int> descending = {6, 5, 4, 3, 2, 1};
+	quickSort(descending);
+	assert((descending == std::list<int>{1, 2, 3, 4, 5, 6}));
+}
+
+// Test case 14: resumable sort gives the same result as quickSort for any budget
+void testResumableMatchesQuickSort()
+{
+	std::mt19937 gen(7);
+	for(const std::size_t budget : {1, 3, 17, 1000})
+	{
+		std::vector<int> vec(5000);
+		for(auto &x : vec)
+		{
+			x = gen() % 100; // Plenty of duplicates
+		}
+		auto expected = vec;
+		quickSort(expected.begin(), expected.end());
+		
+		ResumableQuickSort<std::vector<int>::iterator> sorter(vec.begin(), vec.end());
+		double lastProgress = 0.0;
+		while(!sorter.resume(budget))
+		{
+			assert(sorter.progress() >= lastProgress);
+			lastProgress = sorter.progress();
+		}
+		assert(vec == expected);
+		assert(sorter.progress() == 1.0);
+	}
+	
+	std::vector<int> empty;
+	ResumableQuickSort<std::vector<int>::iterator> emptySorter(empty.begin(), empty.end());
+	assert(emptySorter.resume(1));
+	assert(emptySorter.progress() == 1.0);
+}
+
+// Test case 15: cancelling leaves a permutation of the input and stops further work
+void testResumableCancel()
+{
+	std::vector<int> vec;
+	for(int i = 0; i < 10000; i++)
+	{
+		vec.push_back((i * 7919) % 10007);
+	}
+	auto original = vec;
+	ResumableQuickSort<std::vector<int>::iterator> sorter(vec.begin(), vec.end());
+	assert(!sorter.resume(5000));
+	sorter.cancel();
+	assert(sorter.cancelled());
+	const auto progress = sorter.progress();
+	assert(sorter.resume(1000000));
+	assert(sorter.progress() == progress && progress < 1.0);
+	std::sort(vec.begin(), vec.end());
+	std::sort(original.begin(), original.end());
+	assert(vec == original);
+}
+
+// Test case 16: list sorts reuse the context's arena, after the first call nothing is allocated
+void testContextReuse()
+{
+	SortContext ctx;
+	std::list<int> lst;
+	for(int i = 0; i < 10000; i++)
+	{
+		lst.push_back((i * 7919) % 10007);
+	}
+	auto copy = lst;
+	quickSort(copy, ctx);
+	assert(std::is_sorted(copy.begin(), copy.end()));
+	assert(ctx.peakUsage() > 0);
+	const auto capacity = ctx.capacity();
+	
+	for(int round = 0; round < 10; round++)
+	{
+		copy = lst; // Reuses the nodes already in copy
+		const auto before = allocationCount;
+		quickSort(copy, ctx);
+		assert(allocationCount == before);
+		assert(std::is_sorted(copy.begin(), copy.end()));
+	}
+	assert(ctx.capacity() == capacity);
+}
+
+// Test case 17: resumable sort keeps its partition stack inline and never allocates
+void testResumableNoAllocations()
+{
+	std::vector<int> vec;
+	for(int i = 0; i < 100000; i++)
+	{
+		vec.push_back((i * 7919) % 100003);
+	}
+	const auto before = allocationCount;
+	ResumableQuickSort<std::vector<int>::iterator> sorter(vec.begin(), vec.end());
+	while(!sorter.resume(1000)) {}
+	assert(allocationCount == before);
+	assert(std::is_sorted(vec.begin(), vec.end()));
+}
+
+// Test case 18: sorting still works with tuned thresholds, including ninther pivots
+void testTunedThresholds()
+{
+	auto &tuning = sortTuning<QuickSortEngine, int>();
+	const auto saved = tuning;
+	std::mt19937 gen(18);
+	for(const auto candidate : {SortTuning{4, 16, 65536}, SortTuning{48, 64, 65536}, SortTuning{11, neverSample, 65536}})
+	{
+		tuning = candidate;
+		std::vector<int> vec(20000);
+		for(auto &x : vec)
+		{
+			x = gen() % 1000;
+		}
+		auto expected = vec;
+		std::sort(expected.begin(), expected.end());
+		auto resumable = vec;
+		quickSort(vec.begin(), vec.end());
+		assert(vec == expected);
+		ResumableQuickSort<std::vector<int>::iterator> sorter(resumable.begin(), resumable.end());
+		while(!sorter.resume(100)) {}
+		assert(resumable == expected);
+	}
+	tuning = saved;
+}
+
+// Test case 19: tuning cache survives a save and reload, malformed lines are skipped
+void testTuningCacheRoundTrip()
+{
+	const std::string path = "sort_tuning_test.cache";
+	{
+		SortTuningCache cache(path);
+		cache.entry("quickSort:test", QuickSortEngine::defaults()) = SortTuning{24, 512, 262144};
+		cache.entry("quickSort:tiny", QuickSortEngine::defaults()) = SortTuning{1, 2, 3};
+		assert(cache.save());
+	}
+	{
+		std::ofstream append(path, std::ios::app);
+		append << "garbage line\n";
+	}
+	SortTuningCache reloaded(path);
+	const auto loaded = reloaded.entry("quickSort:test", QuickSortEngine::defaults());
+	assert(loaded.insertionCutoff == 24 && loaded.pivotSampleCutoff == 512 && loaded.parallelCutoff == 262144);
+	const auto clamped = reloaded.entry("quickSort:tiny", QuickSortEngine::defaults());
+	assert(clamped.insertionCutoff == 3 && clamped.pivotSampleCutoff == 16);
+	const auto missing = reloaded.entry("garbage", QuickSortEngine::defaults());
+	assert(missing.insertionCutoff == 11);
+	std::remove(path.c_str());
+}
+
+// Buffer of count random records. Key bytes are drawn from [0, keyValues) so small values force long prefix ties and repeated keys.
+std::vector<unsigned char> makeRecords(const std::size_t count, const RecordFormat &format, const unsigned keyValues, std::mt19937 &gen)
+{
+	std::vector<unsigned char> records(count * format.recordSize);
+	for(std::size_t i = 0; i < records.size(); i++)
+	{
+		const auto field = i % format.recordSize;
+		const bool isKey = field >= format.keyOffset && field < format.keyOffset + format.keyLength;
+		records[i] = static_cast<unsigned char>(isKey ? gen() % keyValues : gen());
+	}
+	return records;
+}
+
+// Records sorted by stable sorting their indices on memcmp of the keys
+std::vector<unsigned char> referenceRecordSort(const std::vector<unsigned char> &in, const RecordFormat &format)
+{
+	const std::size_t count = in.size() / format.recordSize;
+	std::vector<std::size_t> order(count);
+	for(std::size_t i = 0; i < count; i++)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+	{
+		return std::memcmp(&in[a * format.recordSize + format.keyOffset], &in[b * format.recordSize + format.keyOffset], format.keyLength) < 0;
+	});
+	std::vector<unsigned char> out;
+	for(const auto i : order)
+	{
+		out.insert(out.end(), in.begin() + i * format.recordSize, in.begin() + (i + 1) * format.recordSize);
+	}
+	return out;
+}
+
+// Test 20: record sort matches a stable memcmp sort for short, long, offset and heavily repeated keys
+void testRecordSort()
+{
+	std::mt19937 gen(20);
+	const RecordFormat formats[] = {{100, 0, 10}, {37, 5, 3}, {64, 10, 20}, {16, 8, 8}};
+	for(const auto &format : formats)
+	{
+		for(const unsigned keyValues : {2u, 256u})
+		{
+			for(const std::size_t count : {std::size_t{0}, std::size_t{1}, std::size_t{5000}})
+			{
+				const auto in = makeRecords(count, format, keyValues, gen);
+				std::vector<unsigned char> out;
+				sortRecords(in, out, format);
+				assert(out == referenceRecordSort(in, format));
+			}
+		}
+	}
+}
+
+// Test 22: dual-pivot quicksort against std::sort, including tied pivots and all equal input
+void testDualPivot()
+{
+	std::mt19937 gen(41);
+	for(std::size_t n = 0; n <= 300; n += 7)
+	{
+		for(const unsigned distinct : {1u, 2u, 5u, 1000000u})
+		{
+			std::vector<int> vec(n);
+			for(auto &x : vec)
+			{
+				x = static_cast<int>(gen() % distinct);
+			}
+			auto expected = vec;
+			std::sort(expected.begin(), expected.end());
+			dualPivotQuickSort(vec.begin(), vec.end());
+			assert(vec == expected);
+		}
+	}
+	std::vector<std::string> words(5000);
+	for(auto &w : words)
+	{
+		w = std::to_string(gen() % 300);
+	}
+	auto expectedWords = words;
+	std::sort(expectedWords.begin(), expectedWords.end());
+	dualPivotQuickSort(words.begin(), words.end());
+	assert(words == expectedWords);
+	
+	std::vector<long> equal(1000000, 7);
+	dualPivotQuickSort(equal.begin(), equal.end());
+	assert(std::all_of(equal.begin(), equal.end(), [](long x) { return x == 7; }));
+}
+
+// Test 23: lazy view reads match the fully sorted range, in order, out of order, all the way through and
+// back to front
+void testLazySortedView()
+{
+	std::mt19937 gen(43);
+	for(const std::size_t n : {std::size_t{0}, std::size_t{1}, std::size_t{5}, std::size_t{100}, std::size_t{20000}})
+	{
+		std::vector<int> vec(n);
+		for(auto &x : vec)
+		{
+			x = static_cast<int>(gen() % (n + 1)) - static_cast<int>(n / 2);
+		}
+		auto expected = vec;
+		std::sort(expected.begin(), expected.end());
+		
+		// First page, then scattered reads
+		auto paged = vec;
+		LazySortedView<std::vector<int>::iterator> view(paged.begin(), paged.end());
+		assert(view.size() == n);
+		std::size_t read = 0;
+		for(auto it = view.begin(); it != view.end() && read < 50; ++it, ++read)
+		{
+			assert(*it == expected[read]);
+		}
+		assert(view.sortedPrefix() >= read);
+		for(int probe = 0; probe < 200 && n > 0; probe++)
+		{
+			const auto i = gen() % n;
+			assert(view[i] == expected[i]);
+		}
+		// Reading everything leaves the range sorted
+		std::size_t i = 0;
+		for(const auto &x : view)
+		{
+			assert(x == expected[i++]);
+		}
+		assert(view.sortedPrefix() == n);
+		assert(paged == expected);
+		
+		// Back to front, so sorted chunks pile up above sortedEnd until the rest is sorted in one go
+		auto reversed = vec;
+		LazySortedView<std::vector<int>::iterator> reversedView(reversed.begin(), reversed.end());
+		for(std::size_t j = n; j > 0; j--)
+		{
+			assert(reversedView[j - 1] == expected[j - 1]);
+		}
+		assert(reversedView.sortedPrefix() == n);
+		assert(reversed == expected);
+	}
+}
+
+// Largest k of items, largest first
+std::vector<int> expectedTopK(std::vector<int> items, const std::size_t k)
+{
+	std::sort(items.begin(), items.end(), std::greater<int>());
+	items.resize(std::min(k, items.size()));
+	return items;
+}
+
+// Test 24: top-k accumulator against a full sort, single and batch pushes, and per-thread accumulators merged
+// (also into themselves)
+void testTopK()
+{
+	std::mt19937 gen(44);
+	for(const std::size_t k : {std::size_t{1}, std::size_t{10}, std::size_t{500}})
+	{
+		for(const std::size_t n : {std::size_t{0}, std::size_t{5}, std::size_t{100000}})
+		{
+			std::vector<int> items(n);
+			for(auto &x : items)
+			{
+				x = static_cast<int>(gen() % 50000); // Plenty of ties
+			}
+			TopK<int> single(k);
+			for(const auto x : items)
+			{
+				single.push(x);
+			}
+			assert(single.result() == expectedTopK(items, k));
+			TopK<int> batch(k);
+			batch.push(items.begin(), items.end());
+			assert(batch.result() == single.result());
+		}
+	}
+	
+	// Four threads ingest a quarter each, then merge
+	std::vector<int> items(400000);
+	for(auto &x : items)
+	{
+		x = static_cast<int>(gen());
+	}
+	std::vector<TopK<int>> perThread(4, TopK<int>(100));
+	std::vector<std::thread> threads;
+	for(std::size_t t = 0; t < perThread.size(); t++)
+	{
+		threads.emplace_back([&, t] { perThread[t].push(items.begin() + t * 100000, items.begin() + (t + 1) * 100000); });
+	}
+	for(auto &thread : threads)
+	{
+		thread.join();
+	}
+	for(std::size_t t = 1; t < perThread.size(); t++)
+	{
+		perThread[0].merge(perThread[t]);
+	}
+	perThread[0].merge(perThread[0]);
+	assert(perThread[0].result() == expectedTopK(items, 100));
+
+	assert(perThread[0].threshold().has_value());
+}
+
+#if defined(__cpp_lib_constexpr_algorithms) && defined(__cpp_lib_is_constant_evaluated)
+// Sorted copy of arr, usable in constant expressions
+template<typename T, std::size_t N>
+constexpr std::array<T, N> sortedArray(std::array<T, N> arr)
+{
+	quickSort(arr.begin(), arr.end());
+	return arr;
+}
+
+// Pseudo random table big enough to go through Partition several levels deep
+constexpr std::array<int, 300> constexprTable()
+{
+	std::array<int, 300> table{};
+	unsigned state = 12345;
+	for(auto &x : table)
+	{
+		state = state * 1103515245 + 12345;
+		x = static_cast<int>(state >> 16) % 100;
+	}
+	return table;
+}
+
+constexpr int constexprMedianOf3(std::array<int, 3> arr)
+{
+	return *medianOf3(arr.begin(), std::prev(arr.end()));
+}
+
+constexpr std::array<int, 24> constexprInput = {42, -7, 13, 0, 99, 13, 5, -7, 64, 21, 8, 77, 3, 3, 3, 50, -100, 31, 18, 2, 90, 11, 0, 7};
+constexpr auto constexprSorted = sortedArray(constexprInput);
+static_assert(constexprSorted == std::array<int, 24>{-100, -7, -7, 0, 0, 2, 3, 3, 3, 5, 7, 8, 11, 13, 13, 18, 21, 31, 42, 50, 64, 77, 90, 99});
+static_assert(sortedArray(std::array<char, 3>{'c', 'a', 'b'}) == std::array<char, 3>{'a', 'b', 'c'});
+static_assert(sortedArray(std::array<int, 0>{}).empty());
+static_assert(sortedArray(std::array<int, 1>{5})[0] == 5);
+constexpr auto constexprSortedTable = sortedArray(constexprTable());
+static_assert(std::is_sorted(constexprSortedTable.begin(), constexprSortedTable.end()));
+static_assert(constexprMedianOf3({3, 1, 2}) == 2 && constexprMedianOf3({1, 1, 0}) == 1);
+
+// Test 21: tables sorted at compile time match the same sort done at run time
+void testConstexprSort()
+{
+	auto input = constexprInput;
+	quickSort(input.begin(), input.end());
+	assert(input == constexprSorted);
+	auto table = constexprTable();
+	quickSort(table.begin(), table.end());
+	assert(table == constexprSortedTable);
+}
+#endif
+
+// Quicksort tests
+// Stress Test Cases
+// Test 1: large vector with random longs
+void testLongRand()
+{
+	std::vector<long> vec;
+	vec.reserve(50010000); // Reserve memory for efficiency
+	for(size_t i = -10000; i <= 50000000; i++)
+	{
+	  if(i % 5 == 0) vec.push_back(i - 20);
+	  else if(i % 3 == 0) vec.push_back(i + 20);
+	  else if(i % 7 == 0) vec.push_back(i + 1);
+	  else vec.push_back(i);
+	}
+	
+	quickSort(vec.begin(), vec.end());	
+	assert(std::is_sorted(vec.begin(), vec.end()));
+}
+
+// Test 2: large vector of duplicates
+void testLongDups()
+{
+	std::vector<long> vec;
+	vec.reserve(100000);
+	for(size_t i = 1; i <= vec.capacity(); i++)
+	{
+	  vec.push_back(321);
+	}
+	
+	quickSort(vec.begin(), vec.end());
+	assert(std::is_sorted(vec.begin(), vec.end()));
+}
+
+// Test 3: large vector in ascending order
+void testAscending()
+{
+	std::vector<int> ascendingVec;
+    ascendingVec.reserve(100000000);
+
+    for (size_t i = 1; i <= ascendingVec.capacity(); i++)
+	{
+        ascendingVec.push_back(i);
+    }
+	
+	quickSort(ascendingVec.begin(), ascendingVec.end());
+	assert(std::is_sorted(ascendingVec.begin(), ascendingVec.end()));
+}
+
+// Test 4: large vector in descending order
+void testDescending()
+{
+	std::vector<int> descendingVec;
+    descendingVec.reserve(100000000);
+
+    for (size_t i = descendingVec.capacity(); i <= 1; i--)
+	{
+        descendingVec.push_back(i);
+    }
+	
+	quickSort(descendingVec.begin(), descendingVec.end());
+	assert(std::is_sorted(descendingVec.begin(), descendingVec.end()));
+}
+
+// Test 5: large vector with adjacent elements alternating between positive and negative
+void testAlternating2()
+{
+	std::vector<int> alternatingVec;
+    alternatingVec.reserve(10000000);
+
+    for (size_t i = 1; i <= alternatingVec.capacity(); i++)
+	{
+		int value = (i % 2 == 0) ? -i : i;
+		alternatingVec.push_back(value);
+    }
+	
+	quickSort(alternatingVec.begin(), alternatingVec.end());
+	assert(std::is_sorted(alternatingVec.begin(), alternatingVec.end()));
+}
+
+// Test 6: large vector, mostly ascending except every 10th element is negative
+void testAlternating10()
+{
+	std::vector<int> ascendingVec;
+    ascendingVec.reserve(1000000);
+
+    for (size_t i = 1; i <= ascendingVec.capacity(); i++) {
+        int value = (i % 10 == 0) ? -i : i;
+        ascendingVec.push_back(value);
+    }
+	
+	quickSort(ascendingVec.begin(), ascendingVec.end());
+	assert(std::is_sorted(ascendingVec.begin(), ascendingVec.end()));
+}
+
+
+// Test 7: large list with a mix of ascending and descending runs
+void testLongList()
+{
+	std::list<long> lst;
+	for(long i = 0; i < 2000000; i++)
+	{
+		if((i / 1000) % 3 == 0) lst.push_back(-i); // Descending run
+		else if(i % 7 == 0) lst.push_back((i * 7919) % 1000003); // Noise
+		else lst.push_back(i);
+	}
+	
+	quickSort(lst);
+	assert(lst.size() == 2000000);
+	assert(std::is_sorted(lst.begin(), lst.end()));
+}
+
+// Test 8: large vector sorted in time slices against a blocking sort. Pauses are wall clock time, so the
+// scheduler can stretch any few of them by milliseconds; the bound is asserted on the 99th percentile and
+// the longest pause is only reported.
+void testResumableTimeSliced()
+{
+	const std::size_t n = 10000000;
+	std::mt19937 gen(1);
+	std::vector<int> vec(n);
+	for(auto &x : vec)
+	{
+		x = static_cast<int>(gen());
+	}
+	auto blocking = vec;
+	
+	auto start = std::chrono::steady_clock::now();
+	quickSort(blocking.begin(), blocking.end());
+	const auto blockingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	ResumableQuickSort<std::vector<int>::iterator> sorter(vec.begin(), vec.end());
+	double slicedTime = 0.0;
+	std::vector<double> pauses;
+	bool done = false;
+	while(!done)
+	{
+		const auto sliceStart = std::chrono::steady_clock::now();
+		done = sorter.resumeFor(std::chrono::microseconds(500));
+		const auto pause = std::chrono::duration<double>(std::chrono::steady_clock::now() - sliceStart).count();
+		slicedTime += pause;
+		pauses.push_back(pause);
+	}
+	assert(vec == blocking);
+	std::sort(pauses.begin(), pauses.end());
+	const double p99 = pauses[pauses.size() * 99 / 100];
+	std::cout << "Blocking sort " << blockingTime << " s, time sliced sort " << slicedTime << " s, pauses p99 " << p99 * 1000 << " ms, longest " << pauses.back() * 1000 << " ms" << std::endl;
+	assert(p99 < 0.002); // 500 us slices, 1 ms goal, with room for a loaded machine
+}
+
+// Sort a buffer of 100 byte records with 10 byte keys and report the throughput
+void recordSortThroughput(const std::size_t count)
+{
+	const RecordFormat format{100, 0, 10};
+	std::mt19937 gen(10);
+	const auto in = makeRecords(count, format, 256, gen);
+	std::vector<unsigned char> out(in.size());
+	const auto start = std::chrono::steady_clock::now();
+	sortRecords(in.data(), out.data(), count, format, threadSortContext());
+	const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for(std::size_t i = 1; i < count; i++)
+	{
+		assert(std::memcmp(&out[(i - 1) * format.recordSize], &out[i * format.recordSize], format.keyLength) <= 0);
+	}
+	std::cout << "Sorted " << in.size() / 1e9 << " GB of records in " << time << " s, " << in.size() / 1e9 / time << " GB/s" << std::endl;
+}
+
+// Test 10: two million 100 byte records
+void testRecordSortThroughput()
+{
+	recordSortThroughput(2000000);
+}
+
+// Test 11: dual-pivot quicksort head to head with qs
+void testDualPivotAgainstQs()
+{
+	const std::size_t n = 10000000;
+	const std::pair<const char *, std::function<int(std::size_t, std::mt19937 &)>> inputs[] = {
+		{"random", [](std::size_t, std::mt19937 &gen) { return static_cast<int>(gen()); }},
+		{"1000000 distinct", [](std::size_t, std::mt19937 &gen) { return static_cast<int>(gen() % 1000000); }},
+		{"ascending", [](std::size_t i, std::mt19937 &) { return static_cast<int>(i); }},
+		{"organ pipe", [n](std::size_t i, std::mt19937 &) { return static_cast<int>(i < n / 2 ? i : n - i); }}
+	};
+	for(const auto &input : inputs)
+	{
+		std::mt19937 gen(11);
+		std::vector<int> vec(n);
+		for(std::size_t i = 0; i < n; i++)
+		{
+			vec[i] = input.second(i, gen);
+		}
+		auto dual = vec;
+		
+		auto start = std::chrono::steady_clock::now();
+		quickSort(vec.begin(), vec.end());
+		const auto qsTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		
+		start = std::chrono::steady_clock::now();
+		dualPivotQuickSort(dual.begin(), dual.end());
+		const auto dualTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		
+		assert(dual == vec);
+		std::cout << input.first << ": qs " << qsTime << " s, dual-pivot " << dualTime << " s" << std::endl;
+	}
+}
+
+// Test 12: first page of a lazy view and the whole view against a full quickSort, then the whole view read
+// back to front
+void testLazySortedViewPaging()
+{
+	const std::size_t n = 10000000;
+	std::mt19937 gen(12);
+	std::vector<int> input(n);
+	for(auto &x : input)
+	{
+		x = static_cast<int>(gen());
+	}
+	
+	auto full = input;
+	auto start = std::chrono::steady_clock::now();
+	quickSort(full.begin(), full.end());
+	const auto fullTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	auto lazy = input;
+	LazySortedView<std::vector<int>::iterator> view(lazy.begin(), lazy.end());
+	start = std::chrono::steady_clock::now();
+	long long sum = 0;
+	for(std::size_t i = 0; i < 500; i++)
+	{
+		sum += view[i];
+	}
+	const auto pageTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for(std::size_t i = 500; i < n; i++)
+	{
+		sum += view[i];
+	}
+	const auto allTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	assert(lazy == full && sum != 0);
+	std::cout << "Full quickSort " << fullTime << " s, first 500 of the lazy view " << pageTime << " s, all of it " << allTime << " s" << std::endl;
+	
+	// Reading from the back leaves every cut pending above sortedEnd, so their bookkeeping has to stay cheap
+	auto backwards = input;
+	LazySortedView<std::vector<int>::iterator> reversedView(backwards.begin(), backwards.end());
+	start = std::chrono::steady_clock::now();
+	for(std::size_t i = n; i > 0; i--)
+	{
+		assert(reversedView[i - 1] == full[i - 1]);
+	}
+	const auto backwardsTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	assert(backwards == full && reversedView.sortedPrefix() == n);
+	std::cout << "All of the lazy view read back to front " << backwardsTime << " s, " << backwardsTime / fullTime << "x the full quickSort (front to back " << allTime / fullTime << "x)" << std::endl;
+}
+
+// Test 13: top 100 of a long stream pushed in batches
+void testTopKStream()
+{
+	const std::size_t n = 200000000;
+	TopK<unsigned> top(100);
+	std::vector<unsigned> batch(4096);
+	unsigned state = 13;
+	const auto start = std::chrono::steady_clock::now();
+	for(std::size_t pushed = 0; pushed < n; pushed += batch.size())
+	{
+		for(auto &x : batch)
+		{
+			state = state * 1664525u + 1013904223u;
+			x = state;
+		}
+		top.push(batch.begin(), batch.end());
+	}
+	const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const auto best = top.result();
+	assert(best.size() == 100 && std::is_sorted(best.rbegin(), best.rend()));
+	std::cout << "Top 100 of " << n << " items in " << time << " s, " << n / time / 1e6 << " M items/s" << std::endl;
+}
+
+
+// Adversarial inputs
+// int that counts every comparison made on it
+struct CountedInt
+{
+	int value;
+	inline static std::size_t comparisons = 0;
+	bool operator<(const CountedInt &other) const { comparisons++; return value < other.value; }
+	bool operator>(const CountedInt &other) const { comparisons++; return value > other.value; }
+	bool operator==(const CountedInt &other) const { comparisons++; return value == other.value; }
+	bool operator<=(const CountedInt &other) const { return value <= other.value; } // Only used by asserts
+};
+
+// McIlroy's adversary https://www.cs.dartmouth.edu/~doug/mdmspe.pdf
+// Every item starts out as "gas": equal to other gas and larger than any solid value. When two gas
+// items meet, one is frozen to the next solid value, keeping the likely pivot (the last gas item
+// compared) as gas for as long as possible. Once the sort finishes, the values the items ended up
+// with are an input on which the same sort makes exactly the same bad choices.
+struct AdversaryItem
+{
+	std::size_t index;
+	inline static std::vector<std::size_t> values;
+	inline static std::size_t gas = 0;
+	inline static std::size_t solid = 0;
+	inline static std::size_t candidate = 0;
+	
+	static int compare(const AdversaryItem &a, const AdversaryItem &b)
+	{
+		if(values[a.index] == gas && values[b.index] == gas)
+		{
+			values[a.index == candidate ? a.index : b.index] = solid++;
+		}
+		if(values[a.index] == gas)
+		{
+			candidate = a.index;
+		}
+		else if(values[b.index] == gas)
+		{
+			candidate = b.index;
+		}
+		return values[a.index] < values[b.index] ? -1 : values[a.index] > values[b.index] ? 1 : 0;
+	}
+	bool operator<(const AdversaryItem &other) const { return compare(*this, other) < 0; }
+	bool operator>(const AdversaryItem &other) const { return compare(*this, other) > 0; }
+	bool operator==(const AdversaryItem &other) const { return compare(*this, other) == 0; }
+	bool operator<=(const AdversaryItem &other) const { return compare(*this, other) <= 0; }
+};
+
+// Build McIlroy's killer input for sort, which must sort a std::vector<AdversaryItem> range
+std::vector<int> mcIlroyAdversary(std::size_t n, const std::function<void(std::vector<AdversaryItem>::iterator, std::vector<AdversaryItem>::iterator)> &sort)
+{
+	AdversaryItem::gas = n;
+	AdversaryItem::solid = 0;
+	AdversaryItem::candidate = 0;
+	AdversaryItem::values.assign(n, n);
+	std::vector<AdversaryItem> items;
+	for(std::size_t i = 0; i < n; i++)
+	{
+		items.push_back(AdversaryItem{i});
+	}
+	sort(items.begin(), items.end());
+	return std::vector<int>(AdversaryItem::values.begin(), AdversaryItem::values.end());
+}
+
+// Musser's median-of-3 killer, puts the smallest remaining values where median-of-3 samples
+// https://www.cs.rpi.edu/~musser/gp/introsort.ps
+std::vector<int> medianOf3Killer(std::size_t n)
+{
+	std::vector<int> vec(n);
+	const std::size_t k = n / 2;
+	for(std::size_t i = 1; i <= k; i++)
+	{
+		vec[i - 1] = i % 2 == 1 ? i : k + i - 1;
+		vec[k + i - 1] = 2 * i;
+	}
+	if(n % 2 == 1)
+	{
+		vec[n - 1] = n;
+	}
+	return vec;
+}
+
+// Ascending then descending: 0, 1, ..., n/2, ..., 1, 0
+std::vector<int> organPipe(std::size_t n)
+{
+	std::vector<int> vec(n);
+	for(std::size_t i = 0; i < n; i++)
+	{
+		vec[i] = i < n / 2 ? i : n - 1 - i;
+	}
+	return vec;
+}
+
+// Repeated ascending runs of length period
+std::vector<int> sawtooth(std::size_t n, std::size_t period)
+{
+	std::vector<int> vec(n);
+	for(std::size_t i = 0; i < n; i++)
+	{
+		vec[i] = i % period;
+	}
+	return vec;
+}
+
+// Comparisons quickSort makes on input, relative to n log2 n
+double comparisonRatio(const std::vector<int> &input)
+{
+	std::vector<CountedInt> vec;
+	for(const auto x : input)
+	{
+		vec.push_back(CountedInt{x});
+	}
+	CountedInt::comparisons = 0;
+	quickSort(vec.begin(), vec.end());
+	assert(std::is_sorted(vec.begin(), vec.end(), [](const CountedInt &a, const CountedInt &b) { return a.value < b.value; }));
+	const double n = input.size();
+	return CountedInt::comparisons / (n * std::log2(n));
+}
+
+// Named generator, knownQuadratic marks patterns the current Partition can't handle yet
+struct AdversarialPattern
+{
+	const char *name;
+	std::function<std::vector<int>(std::size_t)> generate;
+	bool knownQuadratic;
+};
+
+std::vector<AdversarialPattern> adversarialPatterns()
+{
+	return {
+		{"random", [](std::size_t n) { std::mt19937 gen(n); std::vector<int> vec(n); for(auto &x : vec) x = static_cast<int>(gen()); return vec; }, false},
+		{"ascending", [](std::size_t n) { return sawtooth(n, n); }, false},
+		{"median-of-3 killer", medianOf3Killer, false},
+		{"organ pipe", organPipe, false},
+		{"sawtooth", [](std::size_t n) { return sawtooth(n, 100); }, true},
+		{"all equal", [](std::size_t n) { return sawtooth(n, 1); }, true},
+		{"McIlroy adversary", [](std::size_t n) { return mcIlroyAdversary(n, [](std::vector<AdversaryItem>::iterator first, std::vector<AdversaryItem>::iterator last) { quickSort(first, last); }); }, true},
+	};
+}
+
+// Test 9: adversarial patterns, the comparison ratio must not grow with n unless the pattern is a known weakness
+void testAdversarialPatterns()
+{
+	for(const auto &pattern : adversarialPatterns())
+	{
+		const auto small = comparisonRatio(pattern.generate(8192));
+		const auto large = comparisonRatio(pattern.generate(32768));
+		const bool quadratic = large > small * 2;
+		std::cout << pattern.name << ": " << small << " -> " << large << " x n log n" << (quadratic ? " (quadratic)" : "") << std::endl;
+		assert(!quadratic || pattern.knownQuadratic);
+	}
+}
+
 // medianOf3 functional test cases
 // Test case 1: Three distinct elements
 void test3Distinct() {
@@ -404,8 +2207,104 @@ void test3DescNeg() {
 	assert(*result == -2);
 }
 
-int main()
+// Test case 7: ninther picks the median of the medians and keeps the ends in order
+void testNinther() {
+	std::vector<int> nums = {9, 1, 5, 2, 8, 3, 7, 4, 6, 0, 10, 11, 12, 13, 14, 15, 16};
+	auto result = medianOf9(nums.begin(), std::prev(nums.end()));
+	assert(result == nums.begin() + 8);
+	assert(nums.front() <= *result && *result <= nums.back());
+}
+
+// Time one quickSort of a fresh random vector of T with whatever thresholds are current
+template<typename T>
+double benchmarkQuickSort()
+{
+	static std::vector<T> input = []
+	{
+		std::mt19937 gen(32);
+		std::vector<T> vec(1000000);
+		for(auto &x : vec)
+		{
+			x = static_cast<T>(gen() % 1000000);
+		}
+		return vec;
+	}();
+	auto vec = input;
+	const auto start = std::chrono::steady_clock::now();
+	quickSort(vec.begin(), vec.end());
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Comparison counts for every adversarial pattern over a range of sizes
+void adversarialBenchmark()
+{
+	for(const auto &pattern : adversarialPatterns())
+	{
+		std::cout << pattern.name << ":";
+		for(std::size_t n = 1024; n <= 65536; n *= 4)
+		{
+			std::cout << " n=" << n << " " << comparisonRatio(pattern.generate(n)) << " x n log n;";
+		}
+		std::cout << std::endl;
+	}
+}
+
+// Time and hardware counters per element for quickSort on each pattern that isn't known to go quadratic
+void perfBenchmark()
+{
+	const std::size_t n = 4000000;
+	PerfCounters counters;
+	for(const auto &pattern : adversarialPatterns())
+	{
+		if(pattern.knownQuadratic)
+		{
+			continue;
+		}
+		auto vec = pattern.generate(n);
+		counters.start();
+		const auto start = std::chrono::steady_clock::now();
+		quickSort(vec.begin(), vec.end());
+		const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		counters.stop();
+		assert(std::is_sorted(vec.begin(), vec.end()));
+		std::cout << pattern.name << ": " << time * 1e9 / n << " ns, " << counters.report(n, "element") << std::endl;
+	}
+}
+
+template<typename T>
+void autoTuneQuickSort(const char *typeName)
 {
+	const auto tuned = autoTune<QuickSortEngine, T>(benchmarkQuickSort<T>, tuneInsertion | tunePivotSample);
+	std::cout << typeName << ": insertion cutoff " << tuned.insertionCutoff << ", ninther above " << tuned.pivotSampleCutoff << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && std::strcmp(argv[1], "--autotune") == 0)
+	{
+		autoTuneQuickSort<int>("int");
+		autoTuneQuickSort<long>("long");
+		autoTuneQuickSort<double>("double");
+		return 0;
+	}
+	if(argc > 1 && std::strcmp(argv[1], "--adversarial") == 0)
+	{
+		adversarialBenchmark();
+		return 0;
+	}
+	if(argc > 1 && std::strcmp(argv[1], "--perf") == 0)
+	{
+		perfBenchmark();
+		return 0;
+	}
+	if(argc > 1 && std::strcmp(argv[1], "--records") == 0)
+	{
+		// Size of the buffer in GB, 100 byte records
+		const double gigabytes = argc > 2 ? std::atof(argv[2]) : 1.0;
+		recordSortThroughput(static_cast<std::size_t>(gigabytes * 1e7));
+		return 0;
+	}
+	
 	std::cout << "Started" << std::endl;
 	// Test pivot selection
 	test3Distinct();
@@ -420,6 +2319,8 @@ int main()
 	std::cout << "Pivot selection test 5 passed" << std::endl;
 	test3DescNeg();
 	std::cout << "Pivot selection test 6 passed" << std::endl;
+	testNinther();
+	std::cout << "Pivot selection test 7 passed" << std::endl;
 	testEmptyRange();
 	// Test correctness of QuickSort implementation
 	std::cout << "Quicksort functional test 1 passed" << std::endl;
@@ -441,6 +2342,36 @@ int main()
 	std::cout << "Quicksort functional test 9 passed" << std::endl;
 	testRandomListSort();
 	std::cout << "Quicksort functional  test 10 passed" << std::endl;
+	testListRelinkOnly();
+	std::cout << "Quicksort functional test 11 passed" << std::endl;
+	testListStable();
+	std::cout << "Quicksort functional test 12 passed" << std::endl;
+	testListEdgeCases();
+	std::cout << "Quicksort functional test 13 passed" << std::endl;
+	testResumableMatchesQuickSort();
+	std::cout << "Quicksort functional test 14 passed" << std::endl;
+	testResumableCancel();
+	std::cout << "Quicksort functional test 15 passed" << std::endl;
+	testContextReuse();
+	std::cout << "Quicksort functional test 16 passed" << std::endl;
+	testResumableNoAllocations();
+	std::cout << "Quicksort functional test 17 passed" << std::endl;
+	testTunedThresholds();
+	std::cout << "Quicksort functional test 18 passed" << std::endl;
+	testTuningCacheRoundTrip();
+	std::cout << "Quicksort functional test 19 passed" << std::endl;
+	testRecordSort();
+	std::cout << "Quicksort functional test 20 passed" << std::endl;
+#if defined(__cpp_lib_constexpr_algorithms) && defined(__cpp_lib_is_constant_evaluated)
+	testConstexprSort();
+	std::cout << "Quicksort functional test 21 passed" << std::endl;
+#endif
+	testDualPivot();
+	std::cout << "Quicksort functional test 22 passed" << std::endl;
+	testLazySortedView();
+	std::cout << "Quicksort functional test 23 passed" << std::endl;
+	testTopK();
+	std::cout << "Quicksort functional test 24 passed" << std::endl;
 	// Test speed of QuickSort implementation
 	testLongRand();
 	std::cout << "Quicksort stress test 1 passed" << std::endl;
@@ -454,6 +2385,20 @@ int main()
 	std::cout << "Quicksort stress test 5 passed" << std::endl;
 	testAlternating10();
 	std::cout << "Quicksort stress test 6 passed" << std::endl;
+	testLongList();
+	std::cout << "Quicksort stress test 7 passed" << std::endl;
+	testResumableTimeSliced();
+	std::cout << "Quicksort stress test 8 passed" << std::endl;
+	testAdversarialPatterns();
+	std::cout << "Quicksort stress test 9 passed" << std::endl;
+	testRecordSortThroughput();
+	std::cout << "Quicksort stress test 10 passed" << std::endl;
+	testDualPivotAgainstQs();
+	std::cout << "Quicksort stress test 11 passed" << std::endl;
+	testLazySortedViewPaging();
+	std::cout << "Quicksort stress test 12 passed" << std::endl;
+	testTopKStream();
+	std::cout << "Quicksort stress test 13 passed" << std::endl;
 
 	
 	std::cout << "Completed" << std::endl;
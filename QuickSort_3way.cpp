@@ -3,8 +3,34 @@
 #include <vector>
 #include <algorithm>
 #include <cassert>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+#include "SortTuning.h"
 
 
+// Tuning keys and defaults, see SortTuning.h
+struct QuickSort3WayEngine
+{
+	static constexpr const char *name = "quickSort3way";
+	static SortTuning defaults() { return {10, neverSample, 65536}; }
+};
+
+struct CoSortEngine
+{
+	static constexpr const char *name = "coSort";
+	static SortTuning defaults() { return {10, neverSample, 65536}; }
+};
+
+// Low cardinality path of quickSort: inputs of at least lowCardinalityMinSize elements are sampled
+// lowCardinalitySamples times, and counted instead of partitioned if the sample holds at most
+// lowCardinalityMaxValues distinct values
+constexpr std::size_t lowCardinalityMinSize = 4096;
+constexpr std::size_t lowCardinalitySamples = 256;
+constexpr std::size_t lowCardinalityMaxValues = 64;
+
 // Function prototypes
 template<typename T>
 void quickSort(std::vector<T> &vec);
@@ -18,6 +44,9 @@ std::pair<typename std::vector<T>::size_type, typename std::vector<T>::size_type
 template<typename T>
 T medianOf3(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high);
 
+template<typename T>
+T medianOf9(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high);
+
 template<typename T>
 void insertionSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high);
 
@@ -27,11 +56,59 @@ void sort2(std::vector<T> &vec, const typename std::vector<T>::size_type low);
 template <typename T>
 void sort3(std::vector<T> &vec, const typename std::vector<T>::size_type low);
 
+template<typename T>
+bool lowCardinalitySort(std::vector<T> &vec);
+
+// What partitionUnique leaves behind: lesser elements in [low, lesserEnd), greater ones in
+// [greaterBegin, high], the slots in between are free
+template<typename T>
+struct UniquePartition
+{
+	typename std::vector<T>::size_type lesserEnd;
+	typename std::vector<T>::size_type greaterBegin;
+	T pivot;
+};
+
+template<typename T>
+typename std::vector<T>::iterator sortUnique(std::vector<T> &vec);
+
+template<typename T>
+typename std::vector<T>::size_type uniqueQs(std::vector<T> &vec, typename std::vector<T>::size_type low, typename std::vector<T>::size_type high, typename std::vector<T>::size_type dest, std::size_t depthBudget);
+
+template<typename T>
+UniquePartition<T> partitionUnique(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high);
+
+template<typename T>
+typename std::vector<T>::size_type uniqueInsertionSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high, const typename std::vector<T>::size_type dest);
+
+template<typename T>
+typename std::vector<T>::size_type uniqueHeapSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high, typename std::vector<T>::size_type dest);
+
+template<typename K, typename... Ps>
+void coSort(std::vector<K> &keys, std::vector<Ps> &... payloads);
+
+template<typename K, typename... Ps>
+void coQs(std::vector<K> &keys, typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads);
+
+template<typename K, typename... Ps>
+std::pair<typename std::vector<K>::size_type, typename std::vector<K>::size_type> coPartition(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads);
+
+template<typename K, typename... Ps>
+K coMedianOf3(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads);
+
+template<typename K, typename... Ps>
+void coInsertionSort(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads);
+
+template<typename K, typename... Ps>
+void swapRows(std::vector<K> &keys, const typename std::vector<K>::size_type i, const typename std::vector<K>::size_type j, std::vector<Ps> &... payloads);
 
+
+// The first sort of each element type looks up its thresholds, and the first sort in the process reads
+// the tuning cache file from the working directory (see SortTuningCache)
 template<typename T>
 void quickSort(std::vector<T> &vec)
 {
-	if(vec.size() > 0)
+	if(vec.size() > 0 && !lowCardinalitySort(vec))
 	{
 		qs(vec, 0, vec.size() - 1);
 	}
@@ -40,6 +117,7 @@ void quickSort(std::vector<T> &vec)
 template<typename T>
 void qs(std::vector<T> &vec, typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high)
 {
+	const auto &tuning = sortTuning<QuickSort3WayEngine, T>();
 	while(low < high)
 	{
 		if(high - low == 1)
@@ -54,7 +132,7 @@ void qs(std::vector<T> &vec, typename std::vector<T>::size_type low, const typen
 			assert(std::is_sorted(vec.begin() + low , vec.begin() + high + 1));
 			low = high + 1;
 		}
-		else if(high - low < 10)
+		else if(high - low < tuning.insertionCutoff)
 		{
 			insertionSort(vec, low, high);
 			assert(std::is_sorted(vec.begin() + low , vec.begin() + high + 1));
@@ -74,7 +152,7 @@ std::pair<typename std::vector<T>::size_type, typename std::vector<T>::size_type
 {
 	assert(high < vec.size() && low >= 0);
 	
-	const auto pivot = medianOf3(vec, low, high);
+	const auto pivot = high - low >= sortTuning<QuickSort3WayEngine, T>().pivotSampleCutoff ? medianOf9(vec, low, high) : medianOf3(vec, low, high);
 	// Lesser, equal and greater indexes
 	auto lt = low;
 	auto eq = low;
@@ -131,10 +209,28 @@ T medianOf3(std::vector<T> &vec, const typename std::vector<T>::size_type low, c
 	return vec.at(mid);
 }
 
+// Tukey's ninther: medianOf3 on three spread out triples leaves their medians at low + step, mid and
+// high - step, one more medianOf3 over those puts the median of medians in the middle, and a last one
+// orders the ends around it so the pivot is still the middle element
+template<typename T>
+T medianOf9(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high)
+{
+	const typename std::vector<T>::size_type step = (high - low) / 8;
+	assert(step > 0);
+	const typename std::vector<T>::size_type mid = low + (high - low) / 2;
+	
+	medianOf3(vec, low, low + 2 * step);
+	medianOf3(vec, mid - step, mid + step);
+	medianOf3(vec, high - 2 * step, high);
+	medianOf3(vec, low + step, high - step);
+	
+	return medianOf3(vec, low, high);
+}
+
 template<typename T>
 void insertionSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high)
 {
-	assert(high - low > 2 && high - low < 10);
+	assert((high - low > 2 && high - low < sortTuning<QuickSort3WayEngine, T>().insertionCutoff));
 	for(auto it = vec.begin() + low + 1; it != vec.begin() + high + 1; std::advance(it, 1))
 	{
 		std::rotate(std::upper_bound(vec.begin() + low, it, *it), it, std::next(it));
@@ -168,6 +264,404 @@ void sort3(std::vector<T> &vec, const typename std::vector<T>::size_type low)
 	assert(vec.at(low) <= vec.at(low + 1) && vec.at(low + 1) <= vec.at(low + 2));
 }
 
+// Few distinct values: count how often each one occurs and write the runs out directly, O(n) instead of
+// a partition pass per distinct value. The distinct values are estimated from a sample; if the full
+// pass meets a value the sample missed, nothing has been written yet and the caller falls back to qs.
+// Integers are rewritten from the table, other types are swapped into place so elements that only
+// compare equal keep their identity (not their relative order, like the rest of quickSort).
+// @return true if vec was sorted
+template<typename T>
+bool lowCardinalitySort(std::vector<T> &vec)
+{
+	if(vec.size() < lowCardinalityMinSize)
+	{
+		return false;
+	}
+	
+	// Sample at pseudo random positions, evenly spaced ones can line up with periodic data
+	std::minstd_rand gen(static_cast<std::minstd_rand::result_type>(vec.size()));
+	std::vector<T> table;
+	table.reserve(lowCardinalitySamples);
+	for(std::size_t i = 0; i < lowCardinalitySamples; i++)
+	{
+		table.push_back(vec[gen() % vec.size()]);
+	}
+	std::sort(table.begin(), table.end());
+	table.erase(std::unique(table.begin(), table.end(), [](const T &a, const T &b) { return !(a < b) && !(b < a); }), table.end());
+	if(table.size() > lowCardinalityMaxValues)
+	{
+		return false;
+	}
+	
+	// Counting pass, slots are kept for the move path
+	std::vector<std::size_t> counts(table.size(), 0);
+	std::vector<unsigned char> slots(std::is_integral<T>::value ? 0 : vec.size());
+	for(std::size_t i = 0; i < vec.size(); i++)
+	{
+		// Branch free search, the table is tiny and the outcome of each step is unpredictable
+		const T *slot = table.data();
+		for(std::size_t n = table.size(); n > 1; n -= n / 2)
+		{
+			slot = slot[n / 2] < vec[i] ? slot + n / 2 : slot;
+		}
+		slot += *slot < vec[i];
+		if(slot == table.data() + table.size() || vec[i] < *slot)
+		{
+			return false; // Value the sample didn't see
+		}
+		counts[slot - table.data()]++;
+		if(!slots.empty())
+		{
+			slots[i] = static_cast<unsigned char>(slot - table.data());
+		}
+	}
+	
+	if constexpr(std::is_integral<T>::value)
+	{
+		auto out = vec.begin();
+		for(std::size_t s = 0; s < table.size(); s++)
+		{
+			out = std::fill_n(out, counts[s], table[s]);
+		}
+	}
+	else
+	{
+		// American flag permutation: next[s] is the first position of run s not yet known to hold a member,
+		// end[s] where run s stops. Each swap settles one element into its run, so n swaps at most, and
+		// no element is ever default constructed or copied.
+		std::vector<std::size_t> next(table.size(), 0);
+		std::vector<std::size_t> end(table.size(), counts[0]);
+		for(std::size_t s = 1; s < table.size(); s++)
+		{
+			next[s] = end[s - 1];
+			end[s] = next[s] + counts[s];
+		}
+		for(std::size_t s = 0; s < table.size(); s++)
+		{
+			while(next[s] < end[s])
+			{
+				const std::size_t i = next[s];
+				const unsigned char owner = slots[i];
+				if(owner == s)
+				{
+					next[s]++;
+					continue;
+				}
+				const std::size_t j = next[owner]++;
+				std::swap(vec[i], vec[j]);
+				std::swap(slots[i], slots[j]);
+			}
+		}
+	}
+	return true;
+}
+
+// Sorts vec and keeps one element of each run of equal elements, like quickSort followed by std::unique,
+// in one pass over the partitions. Copies of the pivot are left where partitionUnique finds them and
+// overwritten later, so a duplicate is never moved once it is known to be one.
+// @return End of the unique elements, everything after it is unspecified (moved-from or discarded copies)
+template<typename T>
+typename std::vector<T>::iterator sortUnique(std::vector<T> &vec)
+{
+	if(vec.empty())
+	{
+		return vec.end();
+	}
+	// Partitions allowed on any one path before the rest of it is heap sorted, as in introsort
+	std::size_t depthBudget = 0;
+	for(auto n = vec.size(); n > 1; n /= 2)
+	{
+		depthBudget += 2;
+	}
+	return vec.begin() + uniqueQs(vec, 0, vec.size() - 1, 0, depthBudget);
+}
+
+// Sorts [low, high] and writes its unique elements from dest on. Everything in [dest, low) is free space.
+// Only the smaller side of each partition is recursed on, so the stack stays O(log n) deep. When that is
+// the greater side its unique elements are packed in place and moved down behind the lesser side's at the end.
+// @return One past the last unique element written
+template<typename T>
+typename std::vector<T>::size_type uniqueQs(std::vector<T> &vec, typename std::vector<T>::size_type low, typename std::vector<T>::size_type high, typename std::vector<T>::size_type dest, std::size_t depthBudget)
+{
+	// A pivot and the packed unique elements of the greater side that go after the lesser side
+	struct Pending
+	{
+		T pivot;
+		typename std::vector<T>::size_type first;
+		typename std::vector<T>::size_type last;
+	};
+	std::vector<Pending> pending;
+	bool done = false;
+	while(!done)
+	{
+		if(high - low < sortTuning<QuickSort3WayEngine, T>().insertionCutoff)
+		{
+			dest = uniqueInsertionSort(vec, low, high, dest);
+			break;
+		}
+		if(depthBudget == 0)
+		{
+			// Pivots keep coming out lopsided (organ pipes and other adversarial orders)
+			dest = uniqueHeapSort(vec, low, high, dest);
+			break;
+		}
+		depthBudget--;
+		auto walls = partitionUnique(vec, low, high);
+		const auto lesserSize = walls.lesserEnd - low;
+		const auto greaterSize = high + 1 - walls.greaterBegin;
+		if(lesserSize <= greaterSize)
+		{
+			// Lesser part, then the pivot, then carry on with the greater part right after them.
+			// The range held at least one copy of the pivot, so there's a free slot for it.
+			if(lesserSize > 0)
+			{
+				dest = uniqueQs(vec, low, walls.lesserEnd - 1, dest, depthBudget);
+			}
+			vec[dest++] = std::move(walls.pivot);
+			low = walls.greaterBegin;
+			done = greaterSize == 0;
+		}
+		else
+		{
+			// Greater part packed where it lies, then carry on with the lesser part
+			const auto greaterEnd = greaterSize > 0 ? uniqueQs(vec, walls.greaterBegin, high, walls.greaterBegin, depthBudget) : walls.greaterBegin;
+			pending.push_back({std::move(walls.pivot), walls.greaterBegin, greaterEnd});
+			high = walls.lesserEnd - 1; // lesserSize > greaterSize >= 0
+		}
+	}
+	// Innermost first: each pending run holds larger elements than everything written after it was set aside
+	while(!pending.empty())
+	{
+		auto &p = pending.back();
+		vec[dest++] = std::move(p.pivot);
+		if(dest != p.first)
+		{
+			dest = static_cast<typename std::vector<T>::size_type>(std::move(vec.begin() + p.first, vec.begin() + p.last, vec.begin() + dest) - vec.begin());
+		}
+		else
+		{
+			dest = p.last; // Already in place, moving onto itself would empty elements like strings
+		}
+		pending.pop_back();
+	}
+	return dest;
+}
+
+// 3-way partition of [low, high] that drops the copies of the pivot instead of gathering them.
+template<typename T>
+UniquePartition<T> partitionUnique(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high)
+{
+	// Median of three by value, swapping the samples into order could move copies that get dropped
+	const auto mid = low + (high - low) / 2;
+	const T &a = vec[low];
+	const T &b = vec[mid];
+	const T &c = vec[high];
+	T pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+	
+	auto lt = low;
+	auto eq = low;
+	auto gt = high + 1; // Greater elements go to [gt, high]
+	while(eq < gt)
+	{
+		if(vec[eq] < pivot)
+		{
+			if(lt != eq)
+			{
+				vec[lt] = std::move(vec[eq]); // Slot lt holds a dropped copy
+			}
+			lt++;
+			eq++;
+		}
+		else if(!(pivot < vec[eq]))
+		{
+			eq++; // Copy of the pivot, stays put until something overwrites it
+		}
+		else
+		{
+			// vec[eq] belongs at the end, step over what's already there
+			while(eq < gt - 1 && pivot < vec[gt - 1])
+			{
+				gt--;
+			}
+			if(eq == gt - 1)
+			{
+				gt--;
+			}
+			else if(vec[gt - 1] < pivot)
+			{
+				std::swap(vec[eq], vec[gt - 1]); // vec[eq] is handled as a lesser element next round
+				gt--;
+			}
+			else
+			{
+				vec[gt - 1] = std::move(vec[eq]); // Overwrites a copy of the pivot
+				gt--;
+				eq++;
+			}
+		}
+	}
+	return {lt, gt, std::move(pivot)};
+}
+
+// Insertion sort of [low, high] into a sorted run of unique elements starting at dest. An element equal
+// to one already in the run is skipped without being touched.
+// @return One past the end of the run
+template<typename T>
+typename std::vector<T>::size_type uniqueInsertionSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high, const typename std::vector<T>::size_type dest)
+{
+	auto out = dest;
+	for(auto i = low; i <= high; i++)
+	{
+		const auto pos = std::lower_bound(vec.begin() + dest, vec.begin() + out, vec[i]);
+		if(pos != vec.begin() + out && !(vec[i] < *pos))
+		{
+			continue;
+		}
+		T value = std::move(vec[i]);
+		std::move_backward(pos, vec.begin() + out, vec.begin() + out + 1); // out <= i, so slot out is free
+		*pos = std::move(value);
+		out++;
+	}
+	return out;
+}
+
+// Heap sort of [low, high], then its unique elements packed from dest on. The fallback when partitioning
+// keeps going badly, O(n log n) whatever the input order.
+// @return One past the last unique element written
+template<typename T>
+typename std::vector<T>::size_type uniqueHeapSort(std::vector<T> &vec, const typename std::vector<T>::size_type low, const typename std::vector<T>::size_type high, typename std::vector<T>::size_type dest)
+{
+	std::make_heap(vec.begin() + low, vec.begin() + high + 1);
+	std::sort_heap(vec.begin() + low, vec.begin() + high + 1);
+	const auto first = dest;
+	for(auto i = low; i <= high; i++)
+	{
+		if(dest == first || vec[dest - 1] < vec[i])
+		{
+			if(dest != i)
+			{
+				vec[dest] = std::move(vec[i]);
+			}
+			dest++;
+		}
+	}
+	return dest;
+}
+
+// Co-sort: sorts the key column and applies every swap to each payload column as well
+// Comparisons only ever read keys, payload columns are touched only when a row moves
+template<typename K, typename... Ps>
+void coSort(std::vector<K> &keys, std::vector<Ps> &... payloads)
+{
+	assert(((payloads.size() == keys.size()) && ...));
+	if(keys.size() > 0)
+	{
+		coQs(keys, 0, keys.size() - 1, payloads...);
+	}
+}
+
+template<typename K, typename... Ps>
+void coQs(std::vector<K> &keys, typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads)
+{
+	const auto &tuning = sortTuning<CoSortEngine, K>();
+	while(low < high)
+	{
+		if(high - low < tuning.insertionCutoff)
+		{
+			coInsertionSort(keys, low, high, payloads...);
+			assert(std::is_sorted(keys.begin() + low , keys.begin() + high + 1));
+			low = high + 1;
+		}
+		else
+		{
+			std::pair<typename std::vector<K>::size_type, typename std::vector<K>::size_type> partitionWalls = coPartition(keys, low, high, payloads...);
+			coQs(keys, low, partitionWalls.first, payloads...);
+			low = partitionWalls.second;
+		}
+	}
+}
+
+// Same 3-way scheme as partition, every swap is mirrored onto the payload columns
+template<typename K, typename... Ps>
+std::pair<typename std::vector<K>::size_type, typename std::vector<K>::size_type> coPartition(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads)
+{
+	assert(high < keys.size() && low >= 0);
+	
+	const auto pivot = coMedianOf3(keys, low, high, payloads...);
+	// Lesser, equal and greater indexes
+	auto lt = low;
+	auto eq = low;
+	auto gt = high;
+	
+	while(eq <= gt)
+	{
+		if(keys.at(eq) < pivot)
+		{
+			swapRows(keys, eq, lt, payloads...);
+			lt++;
+			eq++;
+		}
+		else if(keys.at(eq) > pivot)
+		{
+			swapRows(keys, eq, gt, payloads...);
+			gt--;
+		}
+		else
+		{
+			eq++;
+		}
+	}
+	return std::pair<typename std::vector<K>::size_type, typename std::vector<K>::size_type>(lt, gt);
+}
+
+template<typename K, typename... Ps>
+K coMedianOf3(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads)
+{
+	if(high - low < 2)
+	{
+		return keys.at(low);
+	}
+	
+	const typename std::vector<K>::size_type mid = low + (high - low) / 2;
+	
+	if(keys.at(low) > keys.at(high))
+	{
+		swapRows(keys, low, high, payloads...);
+	}
+	if(keys.at(low) > keys.at(mid))
+	{
+		swapRows(keys, low, mid, payloads...);
+	}
+	if(keys.at(mid) > keys.at(high))
+	{
+		swapRows(keys, mid, high, payloads...);
+	}
+	assert(keys.at(low) <= keys.at(mid) && keys.at(mid) <= keys.at(high));
+	
+	return keys.at(mid);
+}
+
+// std::rotate can't be mirrored onto the payloads cheaply, so shift rows down one swap at a time
+template<typename K, typename... Ps>
+void coInsertionSort(std::vector<K> &keys, const typename std::vector<K>::size_type low, const typename std::vector<K>::size_type high, std::vector<Ps> &... payloads)
+{
+	assert((high - low < sortTuning<CoSortEngine, K>().insertionCutoff));
+	for(auto i = low + 1; i <= high; i++)
+	{
+		for(auto j = i; j > low && keys.at(j - 1) > keys.at(j); j--)
+		{
+			swapRows(keys, j - 1, j, payloads...);
+		}
+	}
+}
+
+template<typename K, typename... Ps>
+void swapRows(std::vector<K> &keys, const typename std::vector<K>::size_type i, const typename std::vector<K>::size_type j, std::vector<Ps> &... payloads)
+{
+	std::swap(keys.at(i), keys.at(j));
+	(std::swap(payloads.at(i), payloads.at(j)), ...);
+}
+
 // Functional test cases
 // Quicksort tests
 // Test case 1: empty vector
@@ -338,9 +832,450 @@ void testAlternatingDuplicates() {
     assert(std::is_sorted(vec.begin(), vec.end()));
 }
 
+// Co-sort tests
+// Test case 1: empty columns
+void testCoSortEmpty()
+{
+	std::vector<int> keys;
+	std::vector<std::string> names;
+	coSort(keys, names);
+	assert(keys.empty() && names.empty());
+}
+
+// Test case 2: one payload column follows its key
+void testCoSortSinglePayload()
+{
+	std::vector<int> keys = {3, 1, 4, 2, 5};
+	std::vector<char> tags = {'c', 'a', 'd', 'b', 'e'};
+	coSort(keys, tags);
+	assert((keys == std::vector<int>{1, 2, 3, 4, 5}));
+	assert((tags == std::vector<char>{'a', 'b', 'c', 'd', 'e'}));
+}
+
+// Test case 3: several payload columns of different types
+void testCoSortMultiplePayloads()
+{
+	std::vector<int> keys = {9, 4, 7, 1, 8, 2, 6, 3, 5, 0, 11, 10, 12};
+	std::vector<std::string> names;
+	std::vector<double> halves;
+	for(const auto k : keys)
+	{
+		names.push_back(std::to_string(k));
+		halves.push_back(k / 2.0);
+	}
+	coSort(keys, names, halves);
+	assert(std::is_sorted(keys.begin(), keys.end()));
+	for(std::vector<int>::size_type i = 0; i < keys.size(); i++)
+	{
+		assert(names.at(i) == std::to_string(keys.at(i)));
+		assert(halves.at(i) == keys.at(i) / 2.0);
+	}
+}
+
+// Test case 4: no payload columns behaves like quickSort
+void testCoSortKeysOnly()
+{
+	std::vector<int> keys = {3, 1, 4, 2, 1, 5, 4};
+	coSort(keys);
+	assert((keys == std::vector<int>{1, 1, 2, 3, 4, 4, 5}));
+}
+
+// Stress test: large duplicate heavy key column, payload rows must stay attached to their keys
+void testCoSortLargeDuplicates()
+{
+	const int n = 1000000;
+	std::vector<int> keys;
+	std::vector<int> rows; // Original position of each key
+	keys.reserve(n);
+	rows.reserve(n);
+	for(int i = 0; i < n; ++i)
+	{
+		keys.push_back((i * 7919L) % 1000);
+		rows.push_back(i);
+	}
+	const std::vector<int> original = keys;
+	coSort(keys, rows);
+	assert(std::is_sorted(keys.begin(), keys.end()));
+	for(int i = 0; i < n; ++i)
+	{
+		assert(original.at(rows.at(i)) == keys.at(i));
+	}
+}
+
+// Tuning tests
+// Test case 1: ninther returns the median of the medians and leaves it in the middle
+void testNinther()
+{
+	std::vector<int> vec = {9, 1, 5, 2, 8, 3, 7, 4, 6, 0, 10, 11, 12, 13, 14, 15, 16};
+	const auto pivot = medianOf9(vec, 0, vec.size() - 1);
+	assert(pivot == 8);
+	assert(vec.at(8) == pivot);
+	assert(vec.front() <= pivot && pivot <= vec.back());
+}
+
+// Test case 2: sorting still works with tuned thresholds, including ninther pivots
+void testTunedThresholds()
+{
+	auto &tuning = sortTuning<QuickSort3WayEngine, int>();
+	auto &coTuning = sortTuning<CoSortEngine, int>();
+	const auto saved = tuning;
+	const auto coSaved = coTuning;
+	std::mt19937 gen(18);
+	for(const auto candidate : {SortTuning{4, 16, 65536}, SortTuning{48, 64, 65536}, SortTuning{10, neverSample, 65536}})
+	{
+		tuning = candidate;
+		coTuning = candidate;
+		std::vector<int> vec(20000);
+		for(auto &x : vec)
+		{
+			x = gen() % 1000;
+		}
+		auto expected = vec;
+		std::sort(expected.begin(), expected.end());
+		auto keys = vec;
+		auto rows = vec;
+		quickSort(vec);
+		assert(vec == expected);
+		coSort(keys, rows);
+		assert(keys == expected && rows == expected);
+	}
+	tuning = saved;
+	coTuning = coSaved;
+}
+
+// Low cardinality tests
+// Element that compares on key only, id tells equal elements apart. No default constructor, the
+// counting path must get by with the elements it was given.
+struct KeyedRow
+{
+	int key;
+	int id;
+	
+	KeyedRow(const int key, const int id) : key(key), id(id) {}
+	bool operator<(const KeyedRow &other) const { return key < other.key; }
+	bool operator>(const KeyedRow &other) const { return other.key < key; }
+	bool operator<=(const KeyedRow &other) const { return !(other.key < key); }
+};
+
+// Test case 1: few distinct values are counted, for integers and for other types
+void testLowCardinality()
+{
+	std::mt19937 gen(38);
+	std::vector<int> ints(100000);
+	for(auto &x : ints)
+	{
+		x = static_cast<int>(gen() % 7) * 1000 - 3000;
+	}
+	auto expected = ints;
+	std::sort(expected.begin(), expected.end());
+	assert(lowCardinalitySort(ints));
+	assert(ints == expected);
+	
+	const std::string words[] = {"pear", "apple", "fig"};
+	std::vector<std::string> strings(20000);
+	for(auto &s : strings)
+	{
+		s = words[gen() % 3];
+	}
+	auto expectedStrings = strings;
+	std::sort(expectedStrings.begin(), expectedStrings.end());
+	quickSort(strings);
+	assert(strings == expectedStrings);
+	
+	// Too many distinct values or too few elements, left to qs
+	std::vector<int> wide(100000);
+	for(auto &x : wide)
+	{
+		x = static_cast<int>(gen());
+	}
+	assert(!lowCardinalitySort(wide));
+	std::vector<int> small(100, 1);
+	assert(!lowCardinalitySort(small));
+}
+
+// Test case 2: a value the sample missed makes it fall back without touching the input
+void testLowCardinalityFallback()
+{
+	std::vector<int> vec(200000);
+	for(std::size_t i = 0; i < vec.size(); i++)
+	{
+		vec[i] = static_cast<int>(i % 4);
+	}
+	vec[123457] = 99;
+	vec[7] = -5;
+	const auto original = vec;
+	assert(!lowCardinalitySort(vec));
+	assert(vec == original);
+	
+	// So the sort below is qs's, not the counting path's
+	quickSort(vec);
+	auto expected = original;
+	std::sort(expected.begin(), expected.end());
+	assert(vec == expected);
+	assert(vec.front() == -5 && vec.back() == 99);
+}
+
+// Test case 3: elements that only compare equal are moved, not rewritten, and none is lost or duplicated
+void testLowCardinalityKeepsElements()
+{
+	const std::size_t n = 50000;
+	std::vector<KeyedRow> rows;
+	rows.reserve(n);
+	for(std::size_t i = 0; i < n; i++)
+	{
+		rows.emplace_back(static_cast<int>((i * 7919) % 5), static_cast<int>(i));
+	}
+	auto expected = rows;
+	std::stable_sort(expected.begin(), expected.end());
+	const auto capacity = rows.capacity();
+	const auto *data = rows.data();
+	assert(lowCardinalitySort(rows));
+	assert(rows.data() == data && rows.capacity() == capacity); // Rewritten in place, not replaced
+	
+	std::vector<bool> seen(n, false);
+	for(std::size_t i = 0; i < n; i++)
+	{
+		assert(rows[i].key == expected[i].key);
+		assert(!seen[rows[i].id] && rows[i].key == static_cast<int>((static_cast<std::size_t>(rows[i].id) * 7919) % 5));
+		seen[rows[i].id] = true;
+	}
+	
+	// Same through quickSort
+	std::shuffle(rows.begin(), rows.end(), std::mt19937(3));
+	quickSort(rows);
+	assert(std::is_sorted(rows.begin(), rows.end()));
+}
+
+// Test case 4: counting against partitioning on 10 distinct values
+void testLowCardinalitySpeed()
+{
+	const std::size_t n = 10000000;
+	std::mt19937 gen(4);
+	std::vector<int> input(n);
+	for(auto &x : input)
+	{
+		x = static_cast<int>(gen() % 10);
+	}
+	
+	auto partitioned = input;
+	auto start = std::chrono::steady_clock::now();
+	qs(partitioned, 0, partitioned.size() - 1);
+	const auto partitionTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	auto counted = input;
+	start = std::chrono::steady_clock::now();
+	quickSort(counted);
+	const auto countTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	assert(counted == partitioned);
+	std::cout << "10 distinct values in " << n << " elements: partitioning " << partitionTime << " s, counting " << countTime << " s" << std::endl;
+}
+
+// Sort unique tests
+// Element that counts every move made from it
+struct MoveCounted
+{
+	int key;
+	inline static std::size_t moves = 0;
+	
+	MoveCounted() : key(0) {}
+	explicit MoveCounted(int k) : key(k) {}
+	MoveCounted(const MoveCounted &) = default;
+	MoveCounted(MoveCounted &&other) noexcept : key(other.key) { moves++; }
+	MoveCounted &operator=(const MoveCounted &) = default;
+	MoveCounted &operator=(MoveCounted &&other) noexcept
+	{
+		key = other.key;
+		moves++;
+		return *this;
+	}
+	bool operator<(const MoveCounted &other) const { return key < other.key; }
+	bool operator>(const MoveCounted &other) const { return other.key < key; }
+	bool operator<=(const MoveCounted &other) const { return !(other.key < key); }
+	bool operator==(const MoveCounted &other) const { return key == other.key; }
+};
+
+// Test case 1: same result as quickSort followed by std::unique, for ints and for elements that own memory
+void testSortUnique()
+{
+	std::mt19937 gen(42);
+	for(const std::size_t n : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{7}, std::size_t{100}, std::size_t{5000}})
+	{
+		for(const unsigned distinct : {1u, 3u, 50u, 1000000u})
+		{
+			std::vector<int> vec(n);
+			for(auto &x : vec)
+			{
+				x = static_cast<int>(gen() % distinct);
+			}
+			auto expected = vec;
+			std::sort(expected.begin(), expected.end());
+			expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+			vec.erase(sortUnique(vec), vec.end());
+			assert(vec == expected);
+		}
+	}
+	std::vector<std::string> words = {"pear", "fig", "apple", "fig", "pear", "kiwi", "apple", "fig"};
+	words.erase(sortUnique(words), words.end());
+	assert((words == std::vector<std::string>{"apple", "fig", "kiwi", "pear"}));	
+	// Elements that a move onto themselves would empty, in runs long enough to reach the pending runs
+	for(const std::size_t n : {std::size_t{200}, std::size_t{5000}})
+	{
+		std::vector<std::vector<int>> rows(n);
+		std::vector<std::string> strings(n);
+		for(std::size_t i = 0; i < n; i++)
+		{
+			rows[i] = {static_cast<int>(gen() % (n / 2)), static_cast<int>(i % 3)};
+			strings[i] = std::to_string(gen() % (n / 2));
+		}
+		auto expectedRows = rows;
+		std::sort(expectedRows.begin(), expectedRows.end());
+		expectedRows.erase(std::unique(expectedRows.begin(), expectedRows.end()), expectedRows.end());
+		rows.erase(sortUnique(rows), rows.end());
+		assert(rows == expectedRows);
+		auto expectedStrings = strings;
+		std::sort(expectedStrings.begin(), expectedStrings.end());
+		expectedStrings.erase(std::unique(expectedStrings.begin(), expectedStrings.end()), expectedStrings.end());
+		strings.erase(sortUnique(strings), strings.end());
+		assert(strings == expectedStrings);
+	}
+}
+
+// Test case 2: copies of a pivot are dropped where they lie, so far fewer moves than sorting them first
+void testSortUniqueMoves()
+{
+	std::mt19937 gen(2);
+	std::vector<MoveCounted> input;
+	for(int i = 0; i < 20000; i++)
+	{
+		input.emplace_back(static_cast<int>(gen() % 300));
+	}
+	
+	auto separate = input;
+	MoveCounted::moves = 0;
+	quickSort(separate);
+	separate.erase(std::unique(separate.begin(), separate.end()), separate.end());
+	const auto separateMoves = MoveCounted::moves;
+	
+	auto fused = input;
+	MoveCounted::moves = 0;
+	fused.erase(sortUnique(fused), fused.end());
+	const auto fusedMoves = MoveCounted::moves;
+	
+	assert(fused.size() == 300 && fused == separate);
+	assert(fusedMoves * 2 < separateMoves);
+}
 
-int main()
+// Test case 3: fused pass against quickSort plus std::unique on duplicate heavy input
+void testSortUniqueSpeed()
 {
+	const std::size_t n = 10000000;
+	std::mt19937 gen(3);
+	std::vector<int> input(n);
+	for(auto &x : input)
+	{
+		x = static_cast<int>(gen() % 100000);
+	}
+	
+	auto separate = input;
+	auto start = std::chrono::steady_clock::now();
+	quickSort(separate);
+	separate.erase(std::unique(separate.begin(), separate.end()), separate.end());
+	const auto separateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	auto fused = input;
+	start = std::chrono::steady_clock::now();
+	fused.erase(sortUnique(fused), fused.end());
+	const auto fusedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	assert(fused == separate);
+	std::cout << "100000 distinct values in " << n << " elements: quickSort + std::unique " << separateTime << " s, sortUnique " << fusedTime << " s" << std::endl;
+}
+
+// Test case 4: organ pipe and sawtooth input, which keep the by-value median of 3 lopsided, at 1M and 10M
+void testSortUniqueAdversarial()
+{
+	for(const std::size_t n : {std::size_t{1000000}, std::size_t{10000000}})
+	{
+		std::vector<int> organPipe(n);
+		for(std::size_t i = 0; i < n; i++)
+		{
+			organPipe[i] = static_cast<int>(i < n / 2 ? i : n - i);
+		}
+		std::vector<int> sawtooth(n);
+		for(std::size_t i = 0; i < n; i++)
+		{
+			sawtooth[i] = static_cast<int>(i % 1000);
+		}
+		for(auto *input : {&organPipe, &sawtooth})
+		{
+			auto expected = *input;
+			std::sort(expected.begin(), expected.end());
+			expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+			const auto start = std::chrono::steady_clock::now();
+			input->erase(sortUnique(*input), input->end());
+			const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			assert(*input == expected);
+			std::cout << (input == &organPipe ? "Organ pipe " : "Sawtooth ") << n << " elements: sortUnique " << time << " s" << std::endl;
+		}
+	}
+}
+
+// Time one sort of a fresh random vector of T with whatever thresholds are current
+template<typename T>
+std::vector<T> &benchmarkInput()
+{
+	static std::vector<T> input = []
+	{
+		std::mt19937 gen(32);
+		std::vector<T> vec(1000000);
+		for(auto &x : vec)
+		{
+			x = static_cast<T>(gen() % 1000);
+		}
+		return vec;
+	}();
+	return input;
+}
+
+template<typename T>
+double benchmarkQuickSort()
+{
+	auto vec = benchmarkInput<T>();
+	const auto start = std::chrono::steady_clock::now();
+	quickSort(vec);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename T>
+double benchmarkCoSort()
+{
+	auto keys = benchmarkInput<T>();
+	auto payload = keys;
+	const auto start = std::chrono::steady_clock::now();
+	coSort(keys, payload);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename T>
+void autoTuneQuickSort(const char *typeName)
+{
+	const auto tuned = autoTune<QuickSort3WayEngine, T>(benchmarkQuickSort<T>, tuneInsertion | tunePivotSample);
+	std::cout << typeName << ": insertion cutoff " << tuned.insertionCutoff << ", ninther above " << tuned.pivotSampleCutoff << std::endl;
+	const auto coTuned = autoTune<CoSortEngine, T>(benchmarkCoSort<T>, tuneInsertion);
+	std::cout << typeName << " co-sort: insertion cutoff " << coTuned.insertionCutoff << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && std::strcmp(argv[1], "--autotune") == 0)
+	{
+		autoTuneQuickSort<int>("int");
+		autoTuneQuickSort<long>("long");
+		autoTuneQuickSort<double>("double");
+		return 0;
+	}
+	
 	std::cout << "Started" << std::endl;
 	testEmptyRange();
 	std::cout << "Quicksort functional test 1 passed" << std::endl;
@@ -376,6 +1311,36 @@ int main()
 	std::cout << "Quicksort stress test 5 passed" << std::endl;
 	testAlternatingDuplicates();
 	std::cout << "Quicksort stress test 6 passed" << std::endl;
+	testCoSortEmpty();
+	std::cout << "Co-sort functional test 1 passed" << std::endl;
+	testCoSortSinglePayload();
+	std::cout << "Co-sort functional test 2 passed" << std::endl;
+	testCoSortMultiplePayloads();
+	std::cout << "Co-sort functional test 3 passed" << std::endl;
+	testCoSortKeysOnly();
+	std::cout << "Co-sort functional test 4 passed" << std::endl;
+	testCoSortLargeDuplicates();
+	std::cout << "Co-sort stress test 1 passed" << std::endl;
+	testNinther();
+	std::cout << "Tuning test 1 passed" << std::endl;
+	testTunedThresholds();
+	std::cout << "Tuning test 2 passed" << std::endl;
+	testLowCardinality();
+	std::cout << "Low cardinality test 1 passed" << std::endl;
+	testLowCardinalityFallback();
+	std::cout << "Low cardinality test 2 passed" << std::endl;
+	testLowCardinalityKeepsElements();
+	std::cout << "Low cardinality test 3 passed" << std::endl;
+	testLowCardinalitySpeed();
+	std::cout << "Low cardinality test 4 passed" << std::endl;
+	testSortUnique();
+	std::cout << "Sort unique test 1 passed" << std::endl;
+	testSortUniqueMoves();
+	std::cout << "Sort unique test 2 passed" << std::endl;
+	testSortUniqueSpeed();
+	std::cout << "Sort unique test 3 passed" << std::endl;
+	testSortUniqueAdversarial();
+	std::cout << "Sort unique test 4 passed" << std::endl;
 	std::cout << "Completed" << std::endl;
 	
 	return 0;
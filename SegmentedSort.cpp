@@ -0,0 +1,543 @@
+// Segmented sort: sorts many independent small segments of one flat array
+// Small segments are sorted with Batcher's odd-even merge sorting network https://en.wikipedia.org/wiki/Batcher_odd%E2%80%93even_mergesort
+#include <iostream>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "SortTuning.h"
+
+// Segments up to this size go through a sorting network, larger ones fall back to std::sort
+constexpr std::size_t maxNetworkSize = 64;
+
+// Tuning key and defaults, only the parallel cutoff applies here, see SortTuning.h
+struct SegmentedSortEngine
+{
+	static constexpr const char *name = "segmentedSort";
+	static SortTuning defaults() { return {maxNetworkSize, neverSample, 65536}; }
+};
+
+// Comparator list of a sorting network for n elements
+using Network = std::vector<std::pair<std::uint8_t, std::uint8_t>>;
+
+// Function prototypes
+template<typename T>
+void segmentedSort(std::vector<T> &values, const std::vector<std::size_t> &offsets);
+
+template<typename T>
+void segmentedSort(std::vector<T> &values, const std::vector<std::size_t> &offsets, unsigned threads);
+
+template<typename T>
+void sortSegmentRange(T *values, const std::size_t *offsets, std::size_t first, std::size_t last);
+
+template<typename T>
+void sortLanes(T *values, const std::size_t *offsets, std::size_t first, std::size_t count);
+
+template<typename T>
+void sortWithNetwork(T *first, std::size_t n);
+
+template<typename T>
+bool containsNaN(const T *first, std::size_t n);
+
+const Network &sortingNetwork(std::size_t n);
+
+
+// Sort every segment [values[offsets[i]], values[offsets[i + 1]]) in place, spread over all hardware threads
+template<typename T>
+void segmentedSort(std::vector<T> &values, const std::vector<std::size_t> &offsets)
+{
+	segmentedSort(values, offsets, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// Sort every segment in place using up to threads workers. Work is split by element count, not segment count.
+template<typename T>
+void segmentedSort(std::vector<T> &values, const std::vector<std::size_t> &offsets, unsigned threads)
+{
+	if(offsets.size() < 2)
+	{
+		return;
+	}
+	assert(offsets.front() == 0 && offsets.back() == values.size());
+	assert(std::is_sorted(offsets.begin(), offsets.end()));
+
+	const std::size_t segments = offsets.size() - 1;
+	const auto parallelCutoff = std::max<std::size_t>(1, sortTuning<SegmentedSortEngine, T>().parallelCutoff);
+	threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(values.size() / parallelCutoff + 1)));
+	if(threads == 1)
+	{
+		sortSegmentRange(values.data(), offsets.data(), 0, segments);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	std::size_t first = 0;
+	for(unsigned t = 1; t <= threads && first < segments; t++)
+	{
+		// Last segment that starts before this worker's share of the elements ends
+		const std::size_t target = values.size() / threads * t;
+		auto last = static_cast<std::size_t>(std::lower_bound(offsets.begin() + first, offsets.end() - 1, target) - offsets.begin());
+		if(t == threads)
+		{
+			last = segments;
+		}
+		if(last > first)
+		{
+			workers.emplace_back(sortSegmentRange<T>, values.data(), offsets.data(), first, last);
+		}
+		first = last;
+	}
+	for(auto &worker : workers)
+	{
+		worker.join();
+	}
+}
+
+// Sort segments [first, last). Arithmetic types are sorted a batch of segments at a time with
+// one segment per SIMD lane, anything else goes through the network one segment at a time.
+// NaN compares false with everything, so a segment holding one goes on its own and gets its NaNs last.
+template<typename T>
+void sortSegmentRange(T *values, const std::size_t *offsets, std::size_t first, std::size_t last)
+{
+	constexpr std::size_t lanes = std::max<std::size_t>(4, 32 / sizeof(T));
+	while(first < last)
+	{
+		if constexpr(std::is_arithmetic<T>::value)
+		{
+			// Only batch segments that all fit a network
+			std::size_t count = 0;
+			while(count < lanes && first + count < last && offsets[first + count + 1] - offsets[first + count] <= maxNetworkSize
+				&& !containsNaN(values + offsets[first + count], offsets[first + count + 1] - offsets[first + count]))
+			{
+				count++;
+			}
+			if(count == lanes)
+			{
+				sortLanes(values, offsets, first, lanes);
+				first += lanes;
+				continue;
+			}
+		}
+		T *segment = values + offsets[first];
+		std::size_t n = offsets[first + 1] - offsets[first];
+		if constexpr(std::is_floating_point<T>::value)
+		{
+			n = static_cast<std::size_t>(std::partition(segment, segment + n, [](const T x) { return !std::isnan(x); }) - segment);
+		}
+		if(n <= maxNetworkSize)
+		{
+			sortWithNetwork(segment, n);
+		}
+		else
+		{
+			std::sort(segment, segment + n);
+		}
+		first++;
+	}
+}
+
+// Transpose count segments into a lane-major buffer, padding short segments with the largest value
+// (+infinity for floating point, so padding never sorts ahead of a real infinity), then run the
+// network for the longest segment. The segments must not hold NaN. Every comparator becomes a min/max across all lanes
+// at once, which the compiler turns into vector instructions.
+template<typename T>
+void sortLanes(T *values, const std::size_t *offsets, std::size_t first, std::size_t count)
+{
+	constexpr std::size_t lanes = std::max<std::size_t>(4, 32 / sizeof(T));
+	assert(count == lanes);
+	alignas(32) T buffer[maxNetworkSize][lanes];
+	constexpr T padding = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+
+	std::size_t n = 0;
+	for(std::size_t lane = 0; lane < lanes; lane++)
+	{
+		n = std::max(n, offsets[first + lane + 1] - offsets[first + lane]);
+	}
+	for(std::size_t lane = 0; lane < lanes; lane++)
+	{
+		const T *segment = values + offsets[first + lane];
+		const std::size_t length = offsets[first + lane + 1] - offsets[first + lane];
+		for(std::size_t i = 0; i < n; i++)
+		{
+			buffer[i][lane] = i < length ? segment[i] : padding;
+		}
+	}
+
+	for(const auto &comparator : sortingNetwork(n))
+	{
+		T *a = buffer[comparator.first];
+		T *b = buffer[comparator.second];
+		// Separate load and store loops so the compiler can see a and b never alias
+		T lo[lanes];
+		T hi[lanes];
+		for(std::size_t lane = 0; lane < lanes; lane++)
+		{
+			// One comparison picks both sides, so equal values such as 0.0 and -0.0 are swapped or kept as a pair
+			const bool swap = b[lane] < a[lane];
+			lo[lane] = swap ? b[lane] : a[lane];
+			hi[lane] = swap ? a[lane] : b[lane];
+		}
+		std::copy(lo, lo + lanes, a);
+		std::copy(hi, hi + lanes, b);
+	}
+
+	for(std::size_t lane = 0; lane < lanes; lane++)
+	{
+		T *segment = values + offsets[first + lane];
+		const std::size_t length = offsets[first + lane + 1] - offsets[first + lane];
+		for(std::size_t i = 0; i < length; i++)
+		{
+			segment[i] = buffer[i][lane];
+		}
+	}
+}
+
+// Sort n <= maxNetworkSize elements with a fixed sequence of compare-exchanges
+template<typename T>
+void sortWithNetwork(T *first, std::size_t n)
+{
+	assert(n <= maxNetworkSize);
+	for(const auto &comparator : sortingNetwork(n))
+	{
+		T &a = first[comparator.first];
+		T &b = first[comparator.second];
+		if constexpr(std::is_arithmetic<T>::value)
+		{
+			// Branchless, network comparisons are close to coin flips on random data. One comparison drives
+			// both selects, std::min and std::max would both return a for 0.0 and -0.0.
+			const bool swap = b < a;
+			const T lo = swap ? b : a;
+			b = swap ? a : b;
+			a = lo;
+		}
+		else if(b < a)
+		{
+			std::swap(a, b);
+		}
+	}
+}
+
+// True if any of the n elements from first is NaN, never for types without one
+template<typename T>
+bool containsNaN(const T *first, std::size_t n)
+{
+	if constexpr(std::is_floating_point<T>::value)
+	{
+		return std::any_of(first, first + n, [](const T x) { return std::isnan(x); });
+	}
+	else
+	{
+		(void)first;
+		(void)n;
+		return false;
+	}
+}
+
+// Batcher's odd-even merge sort for the next power of two, minus every comparator that touches
+// a position >= n. Those positions act as +infinity padding, so dropping them is safe.
+// All networks are built once on first use.
+const Network &sortingNetwork(std::size_t n)
+{
+	static const std::vector<Network> networks = []
+	{
+		std::vector<Network> built(maxNetworkSize + 1);
+		for(std::size_t size = 2; size <= maxNetworkSize; size++)
+		{
+			std::size_t padded = 1;
+			while(padded < size)
+			{
+				padded <<= 1;
+			}
+			for(std::size_t p = 1; p < padded; p <<= 1)
+			{
+				for(std::size_t k = p; k >= 1; k >>= 1)
+				{
+					for(std::size_t j = k % p; j + k < padded; j += 2 * k)
+					{
+						for(std::size_t i = 0; i < k && i + j + k < padded; i++)
+						{
+							if((i + j) / (2 * p) == (i + j + k) / (2 * p) && i + j + k < size)
+							{
+								built[size].emplace_back(i + j, i + j + k);
+							}
+						}
+					}
+				}
+			}
+		}
+		return built;
+	}();
+	assert(n <= maxNetworkSize);
+	return networks[n];
+}
+
+// Build offsets for segments with random sizes in [minSize, maxSize]
+std::vector<std::size_t> randomOffsets(std::size_t segments, std::size_t minSize, std::size_t maxSize, std::mt19937 &gen)
+{
+	std::uniform_int_distribution<std::size_t> size(minSize, maxSize);
+	std::vector<std::size_t> offsets = {0};
+	offsets.reserve(segments + 1);
+	for(std::size_t i = 0; i < segments; i++)
+	{
+		offsets.push_back(offsets.back() + size(gen));
+	}
+	return offsets;
+}
+
+// True if every segment is sorted and holds the same elements as in original
+template<typename T>
+bool segmentsMatch(std::vector<T> values, const std::vector<T> &sorted, const std::vector<std::size_t> &offsets)
+{
+	for(std::size_t i = 0; i + 1 < offsets.size(); i++)
+	{
+		std::sort(values.begin() + offsets[i], values.begin() + offsets[i + 1]);
+	}
+	return values == sorted;
+}
+
+// Segmented sort tests
+// Functional test cases
+// Test case 1: every network size sorts every 0/1 input (0-1 principle)
+void testNetworksZeroOne()
+{
+	for(std::size_t n = 0; n <= 20; n++)
+	{
+		for(std::uint32_t bits = 0; bits < (1u << n); bits++)
+		{
+			std::vector<int> vec(n);
+			for(std::size_t i = 0; i < n; i++)
+			{
+				vec[i] = (bits >> i) & 1;
+			}
+			sortWithNetwork(vec.data(), n);
+			assert(std::is_sorted(vec.begin(), vec.end()));
+		}
+	}
+}
+
+// Test case 2: no segments, empty segments and a single segment
+void testEdgeCases()
+{
+	std::vector<int> empty;
+	segmentedSort(empty, std::vector<std::size_t>{});
+	segmentedSort(empty, std::vector<std::size_t>{0});
+	segmentedSort(empty, std::vector<std::size_t>{0, 0, 0});
+	assert(empty.empty());
+
+	std::vector<int> single = {5, 3, 1, 4, 2};
+	segmentedSort(single, std::vector<std::size_t>{0, 5});
+	assert((single == std::vector<int>{1, 2, 3, 4, 5}));
+
+	std::vector<int> mixed = {3, 1, 2, 9, 7, 8, 5};
+	segmentedSort(mixed, std::vector<std::size_t>{0, 3, 3, 4, 7});
+	assert((mixed == std::vector<int>{1, 2, 3, 9, 5, 7, 8}));
+}
+
+// Test case 3: segments holding the largest value, which is also the lane padding
+void testPaddingValue()
+{
+	std::mt19937 gen(3);
+	const auto offsets = randomOffsets(64, 1, 40, gen);
+	std::vector<int> vec(offsets.back());
+	for(auto &x : vec)
+	{
+		x = gen() % 3 == 0 ? std::numeric_limits<int>::max() : static_cast<int>(gen() % 100) - 50;
+	}
+	auto sorted = vec;
+	segmentedSort(sorted, offsets);
+	assert(segmentsMatch(vec, sorted, offsets));
+}
+
+// Test case 4: mixed segment sizes, including ones too large for a network, for several element types
+void testMixedSizesAndTypes()
+{
+	std::mt19937 gen(4);
+	const auto offsets = randomOffsets(1000, 0, 100, gen);
+
+	std::vector<double> doubles(offsets.back());
+	for(auto &x : doubles)
+	{
+		x = std::uniform_real_distribution<double>(-1.0, 1.0)(gen);
+	}
+	auto sortedDoubles = doubles;
+	segmentedSort(sortedDoubles, offsets);
+	assert(segmentsMatch(doubles, sortedDoubles, offsets));
+
+	std::vector<std::uint8_t> bytes(offsets.back());
+	for(auto &x : bytes)
+	{
+		x = static_cast<std::uint8_t>(gen());
+	}
+	auto sortedBytes = bytes;
+	segmentedSort(sortedBytes, offsets, 3);
+	assert(segmentsMatch(bytes, sortedBytes, offsets));
+
+	std::vector<std::string> strings(offsets.back());
+	for(auto &x : strings)
+	{
+		x = std::to_string(gen() % 1000);
+	}
+	auto sortedStrings = strings;
+	segmentedSort(sortedStrings, offsets);
+	assert(segmentsMatch(strings, sortedStrings, offsets));
+}
+
+// Test case 5: floating point segments with infinities, and with NaNs that go last, batched with ordinary ones
+template<typename T>
+void testInfinityAndNaN()
+{
+	const T inf = std::numeric_limits<T>::infinity();
+	const T nan = std::numeric_limits<T>::quiet_NaN();
+	std::vector<T> reported = {inf, 1, 5, 4, 3, 2, 1, 9, 8, 7, 6, 5, 3, 3, 1, 2, 0};
+	segmentedSort(reported, std::vector<std::size_t>{0, 2, 7, 12, 17});
+	assert((reported == std::vector<T>{1, inf, 1, 2, 3, 4, 5, 5, 6, 7, 8, 9, 0, 1, 2, 3, 3}));
+
+	std::mt19937 gen(5);
+	const auto offsets = randomOffsets(2000, 1, 12, gen);
+	std::vector<T> vec(offsets.back());
+	for(auto &x : vec)
+	{
+		const auto pick = gen() % 20;
+		x = pick == 0 ? inf : pick == 1 ? -inf : pick == 2 ? nan : static_cast<T>(static_cast<int>(gen() % 100) - 50);
+	}
+	auto sorted = vec;
+	segmentedSort(sorted, offsets);
+	for(std::size_t s = 0; s + 1 < offsets.size(); s++)
+	{
+		std::vector<T> expected;
+		std::size_t nans = 0;
+		for(std::size_t i = offsets[s]; i < offsets[s + 1]; i++)
+		{
+			if(std::isnan(vec[i])) nans++;
+			else expected.push_back(vec[i]);
+		}
+		std::sort(expected.begin(), expected.end());
+		for(std::size_t i = 0; i < expected.size(); i++)
+		{
+			assert(sorted[offsets[s] + i] == expected[i]);
+		}
+		for(std::size_t i = expected.size(); i < expected.size() + nans; i++)
+		{
+			assert(std::isnan(sorted[offsets[s] + i]));
+		}
+	}
+}
+
+// Test case 6: 0.0 and -0.0 compare equal but are different elements, none may be duplicated or dropped
+template<typename T>
+void testSignedZeros()
+{
+	std::vector<T> reported = {0.0, -0.0, 1.0, -0.0, 0.0};
+	segmentedSort(reported, std::vector<std::size_t>{0, 5});
+	assert(std::count_if(reported.begin(), reported.end(), [](T x) { return x == 0 && std::signbit(x); }) == 2);
+	assert(std::count_if(reported.begin(), reported.end(), [](T x) { return x == 0 && !std::signbit(x); }) == 2);
+	assert(reported.back() == 1);
+
+	// Enough short segments to go through the lanes as well as the scalar network
+	std::mt19937 gen(6);
+	const auto offsets = randomOffsets(2000, 1, 12, gen);
+	std::vector<T> vec(offsets.back());
+	for(auto &x : vec)
+	{
+		const auto pick = gen() % 3;
+		x = pick == 0 ? T(0) : pick == 1 ? -T(0) : static_cast<T>(static_cast<int>(gen() % 5) - 2);
+	}
+	auto sorted = vec;
+	segmentedSort(sorted, offsets);
+	for(std::size_t s = 0; s + 1 < offsets.size(); s++)
+	{
+		const auto begin = offsets[s];
+		const auto end = offsets[s + 1];
+		assert(std::is_sorted(sorted.begin() + begin, sorted.begin() + end));
+		const auto negativeZeros = [&](const std::vector<T> &v) { return std::count_if(v.begin() + begin, v.begin() + end, [](T x) { return x == 0 && std::signbit(x); }); };
+		const auto positiveZeros = [&](const std::vector<T> &v) { return std::count_if(v.begin() + begin, v.begin() + end, [](T x) { return x == 0 && !std::signbit(x); }); };
+		assert(negativeZeros(sorted) == negativeZeros(vec) && positiveZeros(sorted) == positiveZeros(vec));
+	}
+}
+
+// Stress Test Cases
+// Test 1: millions of tiny segments, reports throughput against sorting each segment on its own
+void testTinySegmentThroughput()
+{
+	const std::size_t segments = 2000000;
+	std::mt19937 gen(1);
+	const auto offsets = randomOffsets(segments, 4, 64, gen);
+	std::vector<int> vec(offsets.back());
+	for(auto &x : vec)
+	{
+		x = static_cast<int>(gen());
+	}
+	auto expected = vec;
+
+	auto start = std::chrono::steady_clock::now();
+	for(std::size_t i = 0; i < segments; i++)
+	{
+		std::sort(expected.begin() + offsets[i], expected.begin() + offsets[i + 1]);
+	}
+	const auto perSegment = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	segmentedSort(vec, offsets);
+	const auto segmented = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	assert(vec == expected);
+	std::cout << "std::sort per segment: " << segments / perSegment << " segments/s, segmentedSort: " << segments / segmented << " segments/s" << std::endl;
+}
+
+// Time one segmentedSort over a fixed batch of random tiny segments with whatever thresholds are current
+double benchmarkSegmentedSort()
+{
+	static std::mt19937 gen(32);
+	static const auto offsets = randomOffsets(200000, 4, 64, gen);
+	static const std::vector<int> input = []
+	{
+		std::vector<int> vec(offsets.back());
+		for(auto &x : vec)
+		{
+			x = static_cast<int>(gen());
+		}
+		return vec;
+	}();
+	auto vec = input;
+	const auto start = std::chrono::steady_clock::now();
+	segmentedSort(vec, offsets);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && std::strcmp(argv[1], "--autotune") == 0)
+	{
+		const auto tuned = autoTune<SegmentedSortEngine, int>(benchmarkSegmentedSort, tuneParallel);
+		std::cout << "int: parallel cutoff " << tuned.parallelCutoff << std::endl;
+		return 0;
+	}
+	
+	std::cout << "Started" << std::endl;
+	testNetworksZeroOne();
+	std::cout << "Segmented sort functional test 1 passed" << std::endl;
+	testEdgeCases();
+	std::cout << "Segmented sort functional test 2 passed" << std::endl;
+	testPaddingValue();
+	std::cout << "Segmented sort functional test 3 passed" << std::endl;
+	testMixedSizesAndTypes();
+	std::cout << "Segmented sort functional test 4 passed" << std::endl;
+	testInfinityAndNaN<double>();
+	testInfinityAndNaN<float>();
+	std::cout << "Segmented sort functional test 5 passed" << std::endl;
+	testSignedZeros<double>();
+	testSignedZeros<float>();
+	std::cout << "Segmented sort functional test 6 passed" << std::endl;
+	testTinySegmentThroughput();
+	std::cout << "Segmented sort stress test 1 passed" << std::endl;
+	std::cout << "Completed" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,353 @@
+// Intersection and union of sorted sets https://en.wikipedia.org/wiki/Exponential_search
+#include <iostream>
+#include <vector>
+#include <string>
+#include <iterator>
+#include <type_traits>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include "BinarySearch.h"
+
+// Size ratio from which walking the smaller set and galloping through the larger one beats merging
+constexpr std::size_t gallop_ratio = 32;
+
+// Elements compared against each other at a time by the block merge
+constexpr std::size_t block_width = 4;
+
+// Return iterator to the first element of [first, last) that is not less than target. Probes 1, 2, 4, ...
+// elements ahead so the cost grows with the distance moved rather than with the length of the range.
+template <typename Iter, typename T>
+Iter gallop_position(Iter first, Iter last, const T &target)
+{
+	if(first == last || !(*first < target))
+	{
+		return first;
+	}
+	// *low < target from here on, which is what binary_search_position needs to return an insertion point
+	auto low = first;
+	typename std::iterator_traits<Iter>::difference_type step = 1;
+	while(step < last - low && *(low + step) < target)
+	{
+		low += step;
+		step *= 2;
+	}
+	auto high = low + std::min(step + 1, last - low);
+	if(high - low == 1)
+	{
+		return high;
+	}
+	return binary_search_position(low, high, target);
+}
+
+// Intersection of a small set with a much larger one, one gallop per element of small
+template <typename T>
+void gallop_intersection(const std::vector<T> &small, const std::vector<T> &large, std::vector<T> &out)
+{
+	auto pos = large.begin();
+	for(const auto &x : small)
+	{
+		pos = gallop_position(pos, large.end(), x);
+		if(pos == large.end())
+		{
+			return;
+		}
+		if(*pos == x)
+		{
+			out.push_back(x);
+			++pos;
+		}
+	}
+}
+
+// Intersection of two sets of similar size. For arithmetic types every element of a block of a is
+// compared with every element of a block of b without branches, which the compiler vectorizes; the
+// block whose last element is smaller can't match anything further on and is skipped.
+template <typename T>
+void merge_intersection(const std::vector<T> &a, const std::vector<T> &b, std::vector<T> &out)
+{
+	std::size_t i = 0;
+	std::size_t j = 0;
+	if constexpr(std::is_arithmetic_v<T>)
+	{
+		// Every element of a block is stored before its match decides whether k moves past it, so the
+		// last block can write up to block_width slots beyond the final result
+		const std::size_t start = out.size();
+		out.resize(start + std::min(a.size(), b.size()) + block_width);
+		std::size_t k = start;
+		while(i + block_width <= a.size() && j + block_width <= b.size())
+		{
+			// Broadcast each element of b against the whole block of a
+			bool match[block_width] = {};
+			for(std::size_t y = 0; y < block_width; y++)
+			{
+				for(std::size_t x = 0; x < block_width; x++)
+				{
+					match[x] |= a[i + x] == b[j + y];
+				}
+			}
+			for(std::size_t x = 0; x < block_width; x++)
+			{
+				out[k] = a[i + x];
+				k += match[x];
+			}
+			const T last_a = a[i + block_width - 1];
+			const T last_b = b[j + block_width - 1];
+			i += last_a <= last_b ? block_width : 0;
+			j += last_b <= last_a ? block_width : 0;
+		}
+		out.resize(k);
+	}
+	// Plain merge for the tail and for other types
+	while(i < a.size() && j < b.size())
+	{
+		if(a[i] < b[j])
+		{
+			i++;
+		}
+		else if(b[j] < a[i])
+		{
+			j++;
+		}
+		else
+		{
+			out.push_back(a[i]);
+			i++;
+			j++;
+		}
+	}
+}
+
+// Intersection of two sorted sets (sorted, no duplicates), picking galloping or merging by size ratio
+template <typename T>
+std::vector<T> sorted_intersection(const std::vector<T> &a, const std::vector<T> &b)
+{
+	const auto &small = a.size() <= b.size() ? a : b;
+	const auto &large = a.size() <= b.size() ? b : a;
+	std::vector<T> out;
+	if(small.empty())
+	{
+		return out;
+	}
+	if(large.size() / small.size() >= gallop_ratio)
+	{
+		gallop_intersection(small, large, out);
+	}
+	else
+	{
+		merge_intersection(a, b, out);
+	}
+	return out;
+}
+
+// Union of two sorted sets (sorted, no duplicates), picking galloping or merging by size ratio
+template <typename T>
+std::vector<T> sorted_union(const std::vector<T> &a, const std::vector<T> &b)
+{
+	const auto &small = a.size() <= b.size() ? a : b;
+	const auto &large = a.size() <= b.size() ? b : a;
+	std::vector<T> out;
+	out.reserve(a.size() + b.size());
+	if(!small.empty() && large.size() / small.size() >= gallop_ratio)
+	{
+		// Copy the stretch of large in front of each element of small in one go
+		auto pos = large.begin();
+		for(const auto &x : small)
+		{
+			auto next = gallop_position(pos, large.end(), x);
+			out.insert(out.end(), pos, next);
+			out.push_back(x);
+			pos = next != large.end() && *next == x ? std::next(next) : next;
+		}
+		out.insert(out.end(), pos, large.end());
+		return out;
+	}
+
+	// Merge, advancing whichever side held the smaller element (both on a tie) without branching on it
+	std::size_t i = 0;
+	std::size_t j = 0;
+	while(i < a.size() && j < b.size())
+	{
+		const bool take_b = b[j] < a[i];
+		const bool take_a = a[i] < b[j];
+		out.push_back(take_b ? b[j] : a[i]);
+		i += !take_b;
+		j += !take_a;
+	}
+	out.insert(out.end(), a.begin() + i, a.end());
+	out.insert(out.end(), b.begin() + j, b.end());
+	return out;
+}
+
+// Intersection of any number of sorted sets. Works from the smallest set up, so the running result
+// only shrinks and the later, larger sets are mostly galloped through.
+template <typename T>
+std::vector<T> sorted_intersection(const std::vector<std::vector<T>> &sets)
+{
+	if(sets.empty())
+	{
+		return {};
+	}
+	std::vector<const std::vector<T> *> order;
+	for(const auto &s : sets)
+	{
+		order.push_back(&s);
+	}
+	std::sort(order.begin(), order.end(), [](const std::vector<T> *x, const std::vector<T> *y) { return x->size() < y->size(); });
+
+	std::vector<T> result = *order.front();
+	for(std::size_t s = 1; s < order.size() && !result.empty(); s++)
+	{
+		result = sorted_intersection(result, *order[s]);
+	}
+	return result;
+}
+
+// Sorted set of n distinct values drawn from [0, universe)
+std::vector<int> random_set(const std::size_t n, const int universe, std::mt19937 &gen)
+{
+	std::uniform_int_distribution<int> dist(0, universe - 1);
+	std::vector<int> values(n);
+	for(auto &v : values)
+	{
+		v = dist(gen);
+	}
+	std::sort(values.begin(), values.end());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
+	return values;
+}
+
+// Set operation tests
+// Test 1: Galloping lands on the first element not less than the target
+void test_gallop_position()
+{
+	const std::vector<int> vec = {1, 3, 5, 7, 9, 11, 13, 15, 17, 19};
+	bool passed = gallop_position(vec.begin(), vec.end(), 0) == vec.begin() && gallop_position(vec.begin(), vec.end(), 20) == vec.end();
+	for(int target = 0; target <= 20; target++)
+	{
+		passed = passed && gallop_position(vec.begin(), vec.end(), target) == std::lower_bound(vec.begin(), vec.end(), target);
+		passed = passed && gallop_position(vec.begin() + 3, vec.end(), target) == std::max(vec.begin() + 3, std::lower_bound(vec.begin(), vec.end(), target));
+	}
+	std::cout << "Test 1 (gallop position): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 2: Pairwise intersection and union agree with the standard library over a range of size ratios
+void test_pairwise()
+{
+	std::mt19937 gen(2);
+	bool passed = true;
+	const std::size_t sizes[] = {0, 1, 3, 4, 5, 17, 100, 1000, 20000};
+	for(const auto na : sizes)
+	{
+		for(const auto nb : sizes)
+		{
+			const auto a = random_set(na, 40000, gen);
+			const auto b = random_set(nb, 40000, gen);
+			std::vector<int> expected;
+			std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+			passed = passed && sorted_intersection(a, b) == expected;
+			expected.clear();
+			std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+			passed = passed && sorted_union(a, b) == expected;
+		}
+	}
+	std::cout << "Test 2 (pairwise against std): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 3: Non-arithmetic elements take the plain merge
+void test_strings()
+{
+	const std::vector<std::string> a = {"apple", "banana", "cherry", "grape", "kiwi", "lemon", "mango"};
+	const std::vector<std::string> b = {"banana", "date", "kiwi", "mango", "peach"};
+	bool passed = sorted_intersection(a, b) == std::vector<std::string>{"banana", "kiwi", "mango"};
+	passed = passed && sorted_union(a, b) == std::vector<std::string>{"apple", "banana", "cherry", "date", "grape", "kiwi", "lemon", "mango", "peach"};
+	std::cout << "Test 3 (strings): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 4: A smaller set almost entirely contained in the larger one fills the output up to its last slot
+void test_contained()
+{
+	bool passed = sorted_intersection(std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8}, std::vector<int>{2, 3, 4, 5}) == std::vector<int>{2, 3, 4, 5};
+	for(int n = 4; n <= 64; n++)
+	{
+		std::vector<int> large(n * 2);
+		std::iota(large.begin(), large.end(), 0);
+		// Every element of small present, then the same with one missing
+		std::vector<int> small(large.begin() + 1, large.begin() + 1 + n);
+		passed = passed && sorted_intersection(large, small) == small && sorted_intersection(small, large) == small;
+		small.back() = n * 4;
+		std::vector<int> expected(small.begin(), small.end() - 1);
+		passed = passed && sorted_intersection(large, small) == expected && sorted_intersection(small, large) == expected;
+	}
+	std::cout << "Test 4 (contained sets): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 5: n-way intersection against repeated std::set_intersection
+void test_n_way()
+{
+	std::mt19937 gen(4);
+	std::vector<std::vector<int>> sets = {random_set(50000, 100000, gen), random_set(300, 100000, gen), random_set(80000, 100000, gen), random_set(20000, 100000, gen)};
+	std::vector<int> expected = sets[0];
+	for(std::size_t s = 1; s < sets.size(); s++)
+	{
+		std::vector<int> next;
+		std::set_intersection(expected.begin(), expected.end(), sets[s].begin(), sets[s].end(), std::back_inserter(next));
+		expected = next;
+	}
+	bool passed = sorted_intersection(sets) == expected && !expected.empty();
+	passed = passed && sorted_intersection(std::vector<std::vector<int>>{}).empty();
+	passed = passed && sorted_intersection(std::vector<std::vector<int>>{sets[1]}) == sets[1];
+	sets.push_back({});
+	passed = passed && sorted_intersection(sets).empty();
+	std::cout << "Test 5 (n-way intersection): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 6: Speed against std::set_intersection for similar and skewed sizes
+void test_intersection_speed()
+{
+	std::mt19937 gen(5);
+	bool passed = true;
+	const std::pair<std::size_t, std::size_t> shapes[] = {{1000000, 1000000}, {1000, 1000000}};
+	for(const auto &shape : shapes)
+	{
+		const auto a = random_set(shape.first, 4000000, gen);
+		const auto b = random_set(shape.second, 4000000, gen);
+		const int repeats = 20;
+
+		std::vector<int> expected;
+		auto start = std::chrono::steady_clock::now();
+		for(int r = 0; r < repeats; r++)
+		{
+			expected.clear();
+			std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+		}
+		const auto std_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::vector<int> actual;
+		start = std::chrono::steady_clock::now();
+		for(int r = 0; r < repeats; r++)
+		{
+			actual = sorted_intersection(a, b);
+		}
+		const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		passed = passed && actual == expected;
+		std::cout << a.size() << " x " << b.size() << ": std::set_intersection " << std_time << " s, sorted_intersection " << time << " s" << std::endl;
+	}
+	std::cout << "Test 6 (intersection speed): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+int main()
+{
+	std::cout << "Set operation tests started" << std::endl;
+
+	test_gallop_position();
+	test_pairwise();
+	test_strings();
+	test_contained();
+	test_n_way();
+	test_intersection_speed();
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+// Reusable scratch memory for the sorting and merging engines
+#ifndef SORT_CONTEXT_H
+#define SORT_CONTEXT_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+// Growable bump arena. Engines that need scratch space open a Scope, allocate from it while they
+// run and give everything back when the Scope ends. When a run didn't fit, the extra blocks are
+// folded into one bigger block once the outermost Scope closes, so repeated calls on inputs of a
+// similar size stop allocating after the first one.
+class SortContext
+{
+public:
+	SortContext() = default;
+	SortContext(const SortContext &) = delete;
+	SortContext &operator=(const SortContext &) = delete;
+
+	// Rewinds the arena to where it was when the Scope was opened. Scopes must nest.
+	class Scope
+	{
+	public:
+		explicit Scope(SortContext &context) : ctx(context), mark(context.used)
+		{
+			ctx.depth++;
+		}
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+		~Scope()
+		{
+			ctx.depth--;
+			ctx.rewind(mark);
+		}
+
+	private:
+		SortContext &ctx;
+		const std::size_t mark;
+	};
+
+	// Memory is only reclaimed when the enclosing Scope ends
+	void *allocate(const std::size_t bytes, const std::size_t alignment)
+	{
+		assert(depth > 0 && "allocate outside of a SortContext::Scope");
+		const std::size_t start = (used + alignment - 1) / alignment * alignment;
+		if(start + bytes <= blockSize)
+		{
+			used = start + bytes;
+			peak = std::max(peak, used + overflowBytes);
+			return block.get() + start;
+		}
+
+		// Doesn't fit, take a one-off block until the arena can be regrown
+		overflow.emplace_back(new unsigned char[bytes + alignment]);
+		overflowBytes += bytes + alignment;
+		peak = std::max(peak, used + overflowBytes);
+		const auto address = reinterpret_cast<std::uintptr_t>(overflow.back().get());
+		return reinterpret_cast<void *>((address + alignment - 1) / alignment * alignment);
+	}
+
+	// Largest number of scratch bytes in use at any one time
+	std::size_t peakUsage() const
+	{
+		return peak;
+	}
+
+	// Bytes the arena can hand out without going back to the heap
+	std::size_t capacity() const
+	{
+		return blockSize;
+	}
+
+	// Free every block, the next use starts from scratch
+	void release()
+	{
+		assert(depth == 0);
+		block.reset();
+		blockSize = 0;
+		overflow.clear();
+		overflowBytes = 0;
+		used = 0;
+	}
+
+private:
+	void rewind(const std::size_t mark)
+	{
+		used = mark;
+		if(depth == 0 && !overflow.empty())
+		{
+			// Regrow to the high water mark so next time everything fits in one block
+			overflow.clear();
+			overflowBytes = 0;
+			blockSize = peak;
+			block.reset(new unsigned char[blockSize]);
+		}
+	}
+
+	std::unique_ptr<unsigned char[]> block;
+	std::size_t blockSize = 0;
+	std::vector<std::unique_ptr<unsigned char[]>> overflow;
+	std::size_t overflowBytes = 0;
+	std::size_t used = 0;
+	std::size_t peak = 0;
+	std::size_t depth = 0;
+};
+
+// One context per thread for callers that don't pass their own
+inline SortContext &threadSortContext()
+{
+	thread_local SortContext context;
+	return context;
+}
+
+// Standard allocator that draws from a SortContext, deallocation is a no-op
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(SortContext &context) : ctx(&context) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : ctx(other.ctx) {}
+
+	T *allocate(const std::size_t n)
+	{
+		return static_cast<T *>(ctx->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *, std::size_t) {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U> &other) const
+	{
+		return ctx == other.ctx;
+	}
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U> &other) const
+	{
+		return ctx != other.ctx;
+	}
+
+private:
+	template<typename U>
+	friend class ArenaAllocator;
+
+	SortContext *ctx;
+};
+
+template<typename T>
+using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,125 @@
+// Load test for SortServer: concurrent clients, latency percentiles and throughput
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+#include <chrono>
+#include <thread>
+#include "SortService.h"
+
+struct LoadResult
+{
+	std::vector<double> latencies; // Seconds per request
+	std::size_t failures = 0;
+};
+
+// One client: repeat sort (or search) requests of n elements until deadline. Refilling the buffer
+// between sorts is left out of the timings, only the round trip through the server is measured.
+LoadResult runClient(const std::string &socketPath, const std::size_t n, const bool search, const std::chrono::steady_clock::time_point deadline, const unsigned seed)
+{
+	LoadResult result;
+	auto client = SortClient::connect(socketPath);
+	const SearchLayout<std::uint64_t> layout{n, n};
+	auto buffer = SharedBuffer::create(search ? layout.bytes() : n * sizeof(std::uint64_t));
+	if(!client || !buffer)
+	{
+		result.failures++;
+		return result;
+	}
+	std::mt19937_64 gen(seed);
+	std::vector<std::uint64_t> source(n);
+	for(auto &x : source)
+	{
+		x = gen();
+	}
+	if(search)
+	{
+		// Keys sorted once, half the targets present
+		std::vector<std::uint64_t> keys = source;
+		std::sort(keys.begin(), keys.end());
+		std::copy(keys.begin(), keys.end(), buffer->as<std::uint64_t>());
+		auto *targets = buffer->as<std::uint64_t>(layout.targetsOffset());
+		for(std::size_t i = 0; i < n; i++)
+		{
+			targets[i] = i % 2 ? keys[gen() % n] : gen();
+		}
+	}
+
+	while(std::chrono::steady_clock::now() < deadline)
+	{
+		if(!search)
+		{
+			std::copy(source.begin(), source.end(), buffer->as<std::uint64_t>());
+		}
+		const auto start = std::chrono::steady_clock::now();
+		const auto status = search ? client->search<std::uint64_t>(*buffer, n, n) : client->sort<std::uint64_t>(*buffer, n);
+		const auto latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if(status != SortStatus::Ok)
+		{
+			result.failures++;
+			if(status == SortStatus::TransportError)
+			{
+				break;
+			}
+			continue;
+		}
+		result.latencies.push_back(latency);
+	}
+	return result;
+}
+
+// Latency at fraction p of sorted latencies
+double percentile(const std::vector<double> &sorted, const double p)
+{
+	if(sorted.empty())
+	{
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc < 2)
+	{
+		std::cout << "Usage: " << argv[0] << " <socket> [clients=8] [seconds=5] [elements=10000] [sort|search]" << std::endl;
+		std::cout << "Start the server first with: SortServer --serve <socket> [threads]" << std::endl;
+		return 1;
+	}
+	const std::string socketPath = argv[1];
+	const std::size_t clients = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+	const double seconds = argc > 3 ? std::atof(argv[3]) : 5.0;
+	const std::size_t n = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 10000;
+	const bool search = argc > 5 && std::strcmp(argv[5], "search") == 0;
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+	std::vector<LoadResult> results(clients);
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for(std::size_t c = 0; c < clients; c++)
+	{
+		threads.emplace_back([&, c] { results[c] = runClient(socketPath, n, search, deadline, static_cast<unsigned>(c + 1)); });
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<double> latencies;
+	std::size_t failures = 0;
+	for(const auto &r : results)
+	{
+		latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+		failures += r.failures;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	std::cout << clients << " clients, " << (search ? "search of " : "sort of ") << n << " uint64_t per request, " << elapsed << " s" << std::endl;
+	std::cout << "Requests: " << latencies.size() << " ok, " << failures << " failed" << std::endl;
+	std::cout << "Throughput: " << latencies.size() / elapsed << " requests/s, " << latencies.size() * n / elapsed << " elements/s" << std::endl;
+	std::cout << "Latency: p50 " << percentile(latencies, 0.5) * 1e6 << " us, p99 " << percentile(latencies, 0.99) * 1e6 << " us, max " << (latencies.empty() ? 0 : latencies.back() * 1e6) << " us" << std::endl;
+	return failures == 0 && !latencies.empty() ? 0 : 1;
+}
@@ -0,0 +1,901 @@
+// Local sort/search daemon: quickSort and binary_search_position over a Unix domain socket, data in shared memory https://man7.org/linux/man-pages/man7/unix.7.html
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <csignal>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "SortTuning.h"
+#include "SortService.h"
+#include "BinarySearch.h"
+
+// Tuning key and defaults for qs, see SortTuning.h
+struct QuickSortEngine
+{
+	static constexpr const char *name = "quickSort";
+	static constexpr SortTuning defaults() { return {11, neverSample, 65536}; }
+};
+
+// Function prototypes
+template<typename Iter>
+void quickSort(Iter begin, Iter end);
+
+template<typename Iter>
+void qs(Iter begin, Iter end);
+
+template <typename Iter>
+Iter Partition(Iter begin, Iter end);
+
+template <typename Iter>
+Iter medianOf3(Iter begin, Iter end);
+
+template <typename Iter>
+Iter medianOf9(Iter begin, Iter end);
+
+template<typename Iter>
+void insertionSort(Iter begin, Iter end);
+
+template <typename Iter>
+void sort2(Iter begin, Iter end);
+
+template <typename Iter>
+void sort3(Iter begin, Iter end);
+
+//Wrapper function to account for std::end returning past the end iterator
+// The first sort of each element type looks up its thresholds, and the first sort in the process reads
+// the tuning cache file from the working directory (see SortTuningCache)
+template<typename Iter>
+void quickSort(Iter begin, Iter end)
+{
+	if(begin == end) return; // Empty vector
+	qs(begin, std::prev(end));
+}
+
+// Sorts a range of elements using the Quick Sort algorithm.
+template<typename Iter>
+void qs(Iter begin, Iter end)
+{
+	const auto tuning = sortTuning<QuickSortEngine, typename std::iterator_traits<Iter>::value_type>();
+	while(std::distance(begin, end) > 0)
+	{
+		if (static_cast<std::size_t>(std::distance(begin, end)) < tuning.insertionCutoff)
+		{
+			if (std::distance(begin, end) == 2) // More efficient to manually sort 2 or 3 elements than recurse
+			{
+				sort3(begin, end);
+				return;
+			}
+			else if (std::distance(begin, end) == 1)
+			{
+				sort2(begin, end);
+				return;
+			}
+			else if (std::distance(begin, end) < 2) // Partitions of size less than 2 are sorted
+			{
+				return;
+			}
+			else
+			{
+				insertionSort(begin, end);
+				return;
+			}
+		}
+		Iter pi = Partition(begin, end); // pi is partition index
+		if(std::distance(begin, pi) > std::distance(pi, end)) // recurse smaller partition first
+		{
+			qs(std::next(pi), end);
+			end = std::prev(pi);
+		}
+		else
+		{
+			qs(begin, pi);
+			begin = std::next(pi);
+		}
+	}
+}
+
+// Partition function for Quicksort
+template <typename Iter>
+Iter Partition(Iter begin, Iter end)
+{
+	Iter lft = begin; // Initialize left index
+	Iter rgt = end; // Initialize right index
+	const auto tuning = sortTuning<QuickSortEngine, typename std::iterator_traits<Iter>::value_type>();
+	auto pivot = static_cast<std::size_t>(std::distance(lft, rgt)) >= tuning.pivotSampleCutoff ? *medianOf9(lft, rgt) : *medianOf3(lft, rgt);
+
+	while(true)
+	{
+		while (*lft < pivot)
+		{
+			lft++;
+		}
+
+		while(*rgt > pivot)
+		{
+			rgt--;
+		}
+
+		if(std::distance(lft, rgt) <= 0)
+		{
+			return rgt;
+		}
+
+		// Check if left and right point to equal elements
+		// This check isn't needed if input has no duplicates
+		if(*lft == *rgt)
+		{
+			std::advance(lft, 1);
+		}
+		else
+		{
+			std::iter_swap(lft, rgt);
+		}
+	}
+}
+
+// @return Median value among the first, middle and last elements and sorts them into ascending order
+// @param end Points to the last element, not one after the last (which std::end() does)
+template <typename Iter>
+Iter medianOf3(Iter begin, Iter end)
+{
+	// General formula for mid point is [begin + (end - begin) / 2]
+	Iter mid = std::next(begin, std::distance(begin, end) / 2);
+	if(*begin > *end)
+	{
+		std::iter_swap(begin, end);
+	}
+	if(*begin > *mid)
+	{
+		std::iter_swap(begin, mid);
+	}
+	if(*mid > *end)
+	{
+		std::iter_swap(mid, end);
+	}
+	assert(*begin <= *mid && *mid <= *end);
+	return mid;
+}
+
+// Tukey's ninther: the median of the medians of three spread out triples, a better pivot estimate on large ranges.
+// The winner is moved to the middle and medianOf3 then puts the first and last elements in order, so
+// Partition still gets the sentinels it relies on.
+template <typename Iter>
+Iter medianOf9(Iter begin, Iter end)
+{
+	const auto step = std::distance(begin, end) / 8;
+	assert(step > 0);
+	Iter mid = std::next(begin, std::distance(begin, end) / 2);
+	Iter lo = medianOf3(begin, std::next(begin, 2 * step));
+	Iter md = medianOf3(std::prev(mid, step), std::next(mid, step));
+	Iter hi = medianOf3(std::prev(end, 2 * step), end);
+	// Median of the three medians
+	if(*lo > *hi) std::swap(lo, hi);
+	if(*lo > *md) std::swap(lo, md);
+	if(*md > *hi) std::swap(md, hi);
+	std::iter_swap(md, mid);
+	return medianOf3(begin, end);
+}
+
+// Insertion sort is effective on small ranges
+template<typename Iter>
+void insertionSort(Iter begin, Iter end)
+{
+	for(auto i = std::next(begin); i != std::next(end); std::advance(i, 1))
+	{
+		std::rotate(std::upper_bound(begin, i, *i), i, std::next(i));
+	}
+}
+
+// Manually sort 2 elements into ascending order
+template <typename Iter>
+void sort2(Iter begin, Iter end)
+{
+	if(*end < *begin)
+	{
+		std::iter_swap(begin, end);
+	}
+	assert(*begin <= *end);
+}
+
+// Manually sort 3 elements into ascending order
+template <typename Iter>
+void sort3(Iter begin, Iter end)
+{
+	auto mid = std::next(begin);
+	assert(std::next(mid) == end);
+	if(*begin > *end)
+	{
+		std::iter_swap(begin, end);
+	}
+	if(*begin > *mid)
+	{
+		std::iter_swap(begin, mid);
+	}
+	if(*mid > *end)
+	{
+		std::iter_swap(mid, end);
+	}
+	assert(*begin <= *mid && *mid <= *end);
+}
+
+// Largest sort scratch buffer a worker keeps between requests, in elements
+constexpr std::size_t scratchKeepElements = 1 << 20;
+
+// Run one request of element type T on its mapped buffer of bytes bytes
+template<typename T>
+SortStatus runRequest(const SortRequest &request, char *data, const std::size_t bytes, std::uint64_t &hits)
+{
+	// Compare counts against what fits instead of multiplying, a hostile count must not overflow
+	if(request.count > bytes / sizeof(T))
+	{
+		return SortStatus::BadBuffer;
+	}
+	T *keys = reinterpret_cast<T *>(data);
+	const auto count = static_cast<std::size_t>(request.count);
+	if(request.op == SortOp::Sort)
+	{
+		// The client can still write to its mapping while the request runs. Partition and insertionSort
+		// scan unguarded between sentinels and would run off the mapping if those changed under them, so
+		// the sort works on a private copy and only the finished result is written back.
+		thread_local std::vector<T> scratch;
+		scratch.assign(keys, keys + count);
+		// Partition's scans run on its sentinels, which a NaN breaks
+		if constexpr(std::is_floating_point_v<T>)
+		{
+			if(std::any_of(scratch.begin(), scratch.end(), [](const T x) { return std::isnan(x); }))
+			{
+				return SortStatus::BadRequest;
+			}
+		}
+		quickSort(scratch.begin(), scratch.end());
+		std::copy(scratch.begin(), scratch.end(), keys);
+		if(scratch.capacity() > scratchKeepElements)
+		{
+			std::vector<T>().swap(scratch); // Don't hold on to the memory of one huge request per worker
+		}
+		return SortStatus::Ok;
+	}
+
+	const SearchLayout<T> layout{count, static_cast<std::size_t>(request.targetCount)};
+	if(request.targetCount > bytes / (sizeof(T) + sizeof(std::uint64_t)) || layout.bytes() > bytes)
+	{
+		return SortStatus::BadBuffer;
+	}
+	const T *targets = reinterpret_cast<const T *>(data + layout.targetsOffset());
+	auto *positions = reinterpret_cast<std::uint64_t *>(data + layout.positionsOffset());
+	// binary_search_position only ever moves between first and last, so keys changing under it give
+	// wrong answers at worst, never an out of range read; each target is read once for the same reason
+	hits = 0;
+	for(std::size_t i = 0; i < layout.targetCount; i++)
+	{
+		const T target = targets[i];
+		const auto it = binary_search_position(keys, keys + count, target);
+		positions[i] = static_cast<std::uint64_t>(it - keys);
+		hits += it != keys + count && *it == target;
+	}
+	return SortStatus::Ok;
+}
+
+// Serves SortClient connections on a Unix domain socket. One thread polls the listening socket and
+// every connection; each time round it drains whatever requests are waiting and queues them as one
+// batch. A pool of workers takes runs of queued requests at a time, maps each request's memfd,
+// sorts or searches it and replies on the request's connection without ever blocking on it.
+// qs is quadratic on input dominated by one repeated value, so this is meant for trusted local callers.
+class SortServer
+{
+public:
+	// Requests a worker takes off the queue in one go, as long as their elements stay under batchElements
+	static constexpr std::size_t maxBatch = 32;
+	static constexpr std::size_t batchElements = 1 << 16;
+
+	SortServer(std::string socketPath, const std::size_t threads) : path(std::move(socketPath)), threadCount(std::max<std::size_t>(threads, 1)) {}
+
+	SortServer(const SortServer &) = delete;
+	SortServer &operator=(const SortServer &) = delete;
+
+	~SortServer()
+	{
+		stop();
+	}
+
+	// Bind the socket and start the poll thread and the workers. False if the socket couldn't be set up.
+	bool start();
+
+	// Finish the requests already queued, then close every connection and remove the socket
+	void stop();
+
+private:
+	struct Connection
+	{
+		explicit Connection(const int socket) : fd(socket) {}
+		~Connection() { close(fd); }
+
+		// The socket is non-blocking, so a client that stops reading its responses can't stall the
+		// worker replying to it. Once its queue is full it is dropped: shutdown wakes the poll thread,
+		// which forgets the connection, and the client sees the socket close.
+		void reply(const SortResponse &response) const
+		{
+			if(!sendWithFd(fd, &response, sizeof(response), -1))
+			{
+				shutdown(fd, SHUT_RDWR);
+			}
+		}
+
+		const int fd;
+	};
+
+	struct Job
+	{
+		std::shared_ptr<Connection> connection; // Keeps the fd from being reused before the reply is sent
+		SortRequest request;
+		int bufferFd;
+	};
+
+	void pollLoop();
+	bool receiveRequests(const std::shared_ptr<Connection> &connection, std::vector<Job> &batch);
+	void worker();
+	void process(const Job &job);
+
+	const std::string path;
+	const std::size_t threadCount;
+	int listenFd = -1;
+	int wakeFd = -1;
+	bool running = false;
+	std::thread poller;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<Job> queue;
+	bool stopping = false;
+};
+
+bool SortServer::start()
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(running || path.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	wakeFd = eventfd(0, EFD_CLOEXEC);
+	unlink(path.c_str()); // Left behind by a server that didn't shut down cleanly
+	if(listenFd < 0 || wakeFd < 0 || bind(listenFd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 128) != 0)
+	{
+		if(listenFd >= 0) close(listenFd);
+		if(wakeFd >= 0) close(wakeFd);
+		listenFd = wakeFd = -1;
+		return false;
+	}
+	// Look up every element type's thresholds now, so the tuning cache file is read here and not
+	// by whichever worker happens to get the first request
+	sortTuning<QuickSortEngine, std::int32_t>();
+	sortTuning<QuickSortEngine, std::int64_t>();
+	sortTuning<QuickSortEngine, std::uint64_t>();
+	sortTuning<QuickSortEngine, double>();
+	running = true;
+	stopping = false;
+	poller = std::thread(&SortServer::pollLoop, this);
+	for(std::size_t t = 0; t < threadCount; t++)
+	{
+		workers.emplace_back(&SortServer::worker, this);
+	}
+	return true;
+}
+
+void SortServer::stop()
+{
+	if(!running)
+	{
+		return;
+	}
+	const std::uint64_t one = 1;
+	if(write(wakeFd, &one, sizeof(one)) != sizeof(one))
+	{
+		std::cerr << "SortServer: couldn't wake the poll thread" << std::endl;
+	}
+	poller.join();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for(auto &w : workers)
+	{
+		w.join();
+	}
+	workers.clear();
+	close(listenFd);
+	close(wakeFd);
+	listenFd = wakeFd = -1;
+	unlink(path.c_str());
+	running = false;
+}
+
+void SortServer::pollLoop()
+{
+	std::map<int, std::shared_ptr<Connection>> connections;
+	std::vector<pollfd> fds;
+	std::vector<Job> batch;
+	while(true)
+	{
+		fds.clear();
+		fds.push_back({wakeFd, POLLIN, 0});
+		fds.push_back({listenFd, POLLIN, 0});
+		for(const auto &c : connections)
+		{
+			fds.push_back({c.first, POLLIN, 0});
+		}
+		if(poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		if(fds[0].revents)
+		{
+			break;
+		}
+		if(fds[1].revents & POLLIN)
+		{
+			const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if(fd >= 0)
+			{
+				connections[fd] = std::make_shared<Connection>(fd);
+			}
+		}
+		for(std::size_t i = 2; i < fds.size(); i++)
+		{
+			if(fds[i].revents && !receiveRequests(connections[fds[i].fd], batch))
+			{
+				connections.erase(fds[i].fd); // Jobs still queued hold their own reference
+			}
+		}
+		if(!batch.empty())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queue.insert(queue.end(), batch.begin(), batch.end());
+			}
+			batch.size() == 1 ? ready.notify_one() : ready.notify_all();
+			batch.clear();
+		}
+	}
+}
+
+// Append every request waiting on connection to batch. False once the peer has gone away.
+bool SortServer::receiveRequests(const std::shared_ptr<Connection> &connection, std::vector<Job> &batch)
+{
+	while(true)
+	{
+		SortRequest request;
+		iovec iov = {&request, sizeof(request)};
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+		msghdr header = {};
+		header.msg_iov = &iov;
+		header.msg_iovlen = 1;
+		header.msg_control = control;
+		header.msg_controllen = sizeof(control);
+		const ssize_t got = recvmsg(connection->fd, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+		if(got < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		if(got == 0)
+		{
+			return false;
+		}
+		int bufferFd = -1;
+		for(cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg))
+		{
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			{
+				std::memcpy(&bufferFd, CMSG_DATA(cmsg), sizeof(int));
+			}
+		}
+		if(got != static_cast<ssize_t>(sizeof(request)) || (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		{
+			// Not a request; answer it without queueing so the client isn't left waiting
+			if(bufferFd >= 0) close(bufferFd);
+			const SortResponse response = {got >= static_cast<ssize_t>(sizeof(std::uint64_t)) ? request.id : 0, SortStatus::BadRequest, 0, 0};
+			connection->reply(response);
+			continue;
+		}
+		batch.push_back({connection, request, bufferFd});
+	}
+}
+
+void SortServer::worker()
+{
+	std::vector<Job> taken;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [this] { return stopping || !queue.empty(); });
+			if(queue.empty())
+			{
+				return;
+			}
+			// A run of small requests costs one wakeup and one lock; a large one is taken on its own
+			std::size_t elements = 0;
+			while(!queue.empty() && taken.size() < maxBatch && (taken.empty() || elements + queue.front().request.count <= batchElements))
+			{
+				elements += queue.front().request.count;
+				taken.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+		}
+		for(const auto &job : taken)
+		{
+			process(job);
+		}
+		taken.clear();
+	}
+}
+
+// True for a memfd that can't shrink. F_GET_SEALS returns -1 for plain files and pipes, which must not
+// pass either: a client could truncate them under the mapping and SIGBUS the server.
+bool sealedAgainstShrinking(const int fd)
+{
+	const int seals = fcntl(fd, F_GET_SEALS);
+	return seals >= 0 && (seals & F_SEAL_SHRINK) != 0;
+}
+
+void SortServer::process(const Job &job)
+{
+	SortResponse response = {job.request.id, SortStatus::BadBuffer, 0, 0};
+	struct stat info;
+	const bool typeKnown = job.request.type <= ElementType::Double && job.request.op <= SortOp::Search;
+	if(!typeKnown)
+	{
+		response.status = SortStatus::BadRequest;
+	}
+	else if(job.bufferFd >= 0 && fstat(job.bufferFd, &info) == 0 && info.st_size > 0 && sealedAgainstShrinking(job.bufferFd))
+	{
+		const auto bytes = static_cast<std::size_t>(info.st_size);
+		// Populate up front: one call faults in the whole buffer instead of a fault per page during the sort
+		void *data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, job.bufferFd, 0);
+		if(data != MAP_FAILED)
+		{
+			char *bytesData = static_cast<char *>(data);
+			switch(job.request.type)
+			{
+			case ElementType::Int32: response.status = runRequest<std::int32_t>(job.request, bytesData, bytes, response.hits); break;
+			case ElementType::Int64: response.status = runRequest<std::int64_t>(job.request, bytesData, bytes, response.hits); break;
+			case ElementType::UInt64: response.status = runRequest<std::uint64_t>(job.request, bytesData, bytes, response.hits); break;
+			case ElementType::Double: response.status = runRequest<double>(job.request, bytesData, bytes, response.hits); break;
+			}
+			munmap(data, bytes);
+		}
+	}
+	if(job.bufferFd >= 0)
+	{
+		close(job.bufferFd);
+	}
+	// SEQPACKET sends are atomic, so workers replying on the same connection don't interleave
+	job.connection->reply(response);
+}
+
+const std::string socket_path = "/tmp/sort_server_test.sock";
+
+// Random values of T, spread over a range wide enough to have few duplicates
+template<typename T>
+void fill_random(T *values, const std::size_t n, std::mt19937_64 &gen)
+{
+	for(std::size_t i = 0; i < n; i++)
+	{
+		if constexpr(std::is_floating_point_v<T>)
+		{
+			values[i] = std::uniform_real_distribution<T>(-1e9, 1e9)(gen);
+		}
+		else
+		{
+			values[i] = static_cast<T>(gen());
+		}
+	}
+}
+
+// Sort n random values of T through client and compare with std::sort
+template<typename T>
+bool sorts_like_std(SortClient &client, const std::size_t n, std::mt19937_64 &gen)
+{
+	std::optional<SharedBuffer> buffer = SharedBuffer::create(n * sizeof(T));
+	if(!buffer)
+	{
+		return false;
+	}
+	fill_random(buffer->as<T>(), n, gen);
+	std::vector<T> expected(buffer->as<T>(), buffer->as<T>() + n);
+	std::sort(expected.begin(), expected.end());
+	return client.sort<T>(*buffer, n) == SortStatus::Ok && std::equal(expected.begin(), expected.end(), buffer->as<T>());
+}
+
+// Search n sorted keys of T for hits and misses through client and compare with binary_search_position in memory
+template<typename T>
+bool searches_like_in_memory(SortClient &client, const std::size_t n, std::mt19937_64 &gen)
+{
+	std::vector<T> keys(n);
+	fill_random(keys.data(), n, gen);
+	std::sort(keys.begin(), keys.end());
+	std::vector<T> targets;
+	for(std::size_t i = 0; i < n; i += 3)
+	{
+		targets.push_back(keys[i]);
+		targets.push_back(static_cast<T>(keys[i] + 1));
+	}
+	targets.push_back(std::numeric_limits<T>::lowest());
+	targets.push_back(std::numeric_limits<T>::max());
+
+	const SearchLayout<T> layout{keys.size(), targets.size()};
+	std::optional<SharedBuffer> buffer = SharedBuffer::create(layout.bytes());
+	if(!buffer)
+	{
+		return false;
+	}
+	std::copy(keys.begin(), keys.end(), buffer->as<T>());
+	std::copy(targets.begin(), targets.end(), buffer->as<T>(layout.targetsOffset()));
+	std::size_t hits = 0;
+	if(client.search<T>(*buffer, keys.size(), targets.size(), &hits) != SortStatus::Ok)
+	{
+		return false;
+	}
+	std::size_t expectedHits = 0;
+	const auto *positions = buffer->as<std::uint64_t>(layout.positionsOffset());
+	for(std::size_t i = 0; i < targets.size(); i++)
+	{
+		const auto it = binary_search_position(keys.begin(), keys.end(), targets[i]);
+		expectedHits += it != keys.end() && *it == targets[i];
+		if(positions[i] != static_cast<std::uint64_t>(it - keys.begin()))
+		{
+			return false;
+		}
+	}
+	return hits == expectedHits;
+}
+
+// Sort server tests
+// Test 1: Sorting every element type and size through the service matches std::sort
+void test_sort(SortClient &client)
+{
+	std::mt19937_64 gen(1);
+	bool passed = true;
+	for(const std::size_t n : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{3}, std::size_t{100}, std::size_t{1000000}})
+	{
+		passed = passed && sorts_like_std<std::int32_t>(client, n, gen) && sorts_like_std<std::int64_t>(client, n, gen);
+		passed = passed && sorts_like_std<std::uint64_t>(client, n, gen) && sorts_like_std<double>(client, n, gen);
+	}
+	std::cout << "Test 1 (sort): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 2: Search positions and hits match binary_search_position in memory
+void test_search(SortClient &client)
+{
+	std::mt19937_64 gen(2);
+	bool passed = true;
+	for(const std::size_t n : {std::size_t{1}, std::size_t{2}, std::size_t{1000}, std::size_t{300000}})
+	{
+		passed = passed && searches_like_in_memory<std::int32_t>(client, n, gen) && searches_like_in_memory<std::int64_t>(client, n, gen);
+		passed = passed && searches_like_in_memory<std::uint64_t>(client, n, gen) && searches_like_in_memory<double>(client, n, gen);
+	}
+	std::cout << "Test 2 (search): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 3: Malformed requests are refused and the connection keeps working
+void test_bad_requests(SortClient &client)
+{
+	std::optional<SharedBuffer> buffer = SharedBuffer::create(4096);
+	bool passed = buffer.has_value();
+	if(buffer)
+	{
+		// Counts past the end of the buffer, including ones that overflow when multiplied
+		passed = passed && client.sort<std::int32_t>(*buffer, 1025) == SortStatus::BadBuffer;
+		passed = passed && client.sort<std::uint64_t>(*buffer, std::size_t{1} << 62) == SortStatus::BadBuffer;
+		passed = passed && client.search<std::int64_t>(*buffer, 100, 300) == SortStatus::BadBuffer;
+		passed = passed && client.search<std::int64_t>(*buffer, 1, std::size_t{1} << 61) == SortStatus::BadBuffer;
+		// Unknown element type and op, no buffer at all
+		passed = passed && client.call({0, SortOp::Sort, static_cast<ElementType>(9), 1, 0}, buffer->fd()).status == SortStatus::BadRequest;
+		passed = passed && client.call({0, static_cast<SortOp>(7), ElementType::Int32, 1, 0}, buffer->fd()).status == SortStatus::BadRequest;
+		passed = passed && client.call({0, SortOp::Sort, ElementType::Int32, 1, 0}, -1).status == SortStatus::BadBuffer;
+		// NaN would break Partition's sentinels
+		buffer->as<double>()[0] = 1.0;
+		buffer->as<double>()[1] = std::nan("");
+		passed = passed && client.sort<double>(*buffer, 2) == SortStatus::BadRequest;
+	}
+	// A memfd that can still shrink
+	const int unsealed = memfd_create("unsealed", MFD_CLOEXEC);
+	passed = passed && unsealed >= 0 && ftruncate(unsealed, 4096) == 0;
+	passed = passed && client.call({0, SortOp::Sort, ElementType::Int32, 10, 0}, unsealed).status == SortStatus::BadBuffer;
+	close(unsealed);
+	// A plain file, which has no seals at all and could be truncated under the server mid-sort
+	char path[] = "/tmp/sort-server-plainXXXXXX";
+	const int plain = mkstemp(path);
+	passed = passed && plain >= 0 && unlink(path) == 0 && ftruncate(plain, 4096) == 0;
+	passed = passed && client.call({0, SortOp::Sort, ElementType::Int32, 10, 0}, plain).status == SortStatus::BadBuffer;
+	close(plain);
+
+	std::mt19937_64 gen(3);
+	passed = passed && sorts_like_std<std::int32_t>(client, 1000, gen);
+	std::cout << "Test 3 (bad requests): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 4: Many clients at once, each checking every answer it gets
+void test_concurrent_clients()
+{
+	const int clients = 8;
+	std::vector<std::thread> threads;
+	std::vector<char> ok(clients, 0);
+	for(int c = 0; c < clients; c++)
+	{
+		threads.emplace_back([c, &ok]
+		{
+			auto client = SortClient::connect(socket_path);
+			std::mt19937_64 gen(100 + c);
+			bool passed = client.has_value();
+			for(int r = 0; passed && r < 200; r++)
+			{
+				passed = r % 2 ? sorts_like_std<std::int64_t>(*client, 1 + gen() % 5000, gen) : searches_like_in_memory<std::uint64_t>(*client, 1 + gen() % 5000, gen);
+			}
+			ok[c] = passed;
+		});
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+	const bool passed = std::all_of(ok.begin(), ok.end(), [](const char x) { return x != 0; });
+	std::cout << "Test 4 (concurrent clients): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 5: A client writing to its buffer while the server sorts it can't take the server down
+void test_buffer_changed_during_sort(SortClient &client)
+{
+	const std::size_t n = 200000;
+	std::optional<SharedBuffer> buffer = SharedBuffer::create(n * sizeof(std::int64_t));
+	bool passed = buffer.has_value();
+	for(std::size_t i = 0; passed && i < n; i++)
+	{
+		buffer->as<std::int64_t>()[i] = static_cast<std::int64_t>(n - i); // A request taken before the first round still has distinct values
+	}
+	std::atomic<bool> stop{false};
+	std::thread scribbler([&]
+	{
+		// Keep rewriting every element, flipping the order each round, so sentinels an unguarded scan
+		// relied on disappear mid-sort. Values stay distinct: a run of one value would make qs quadratic.
+		volatile std::int64_t *values = buffer->as<std::int64_t>();
+		for(std::int64_t round = 1; !stop.load(std::memory_order_relaxed); round++)
+		{
+			for(std::size_t i = 0; i < n; i++)
+			{
+				const auto v = static_cast<std::int64_t>((i * 2654435761u) % n) * round;
+				values[i] = round % 2 ? v : -v;
+			}
+		}
+	});
+	for(int r = 0; passed && r < 50; r++)
+	{
+		passed = client.sort<std::int64_t>(*buffer, n) == SortStatus::Ok;
+	}
+	stop = true;
+	scribbler.join();
+	std::mt19937_64 gen(5);
+	passed = passed && sorts_like_std<std::int64_t>(client, n, gen);
+	std::cout << "Test 5 (buffer changed during sort): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 6: A client that never reads its responses is dropped and doesn't hold up anyone else
+void test_client_not_reading(SortClient &client)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+	const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	bool passed = fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+	std::optional<SharedBuffer> buffer = SharedBuffer::create(64);
+	const SortRequest request = {1, SortOp::Sort, ElementType::Int32, 16, 0};
+	bool dropped = false;
+	for(int sent = 0; passed && !dropped && sent < 1000000;)
+	{
+		if(sendWithFd(fd, &request, sizeof(request), buffer->fd()))
+		{
+			sent++;
+		}
+		else if(errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			pollfd writable = {fd, POLLOUT, 0};
+			poll(&writable, 1, 100);
+		}
+		else
+		{
+			dropped = errno == EPIPE || errno == ECONNRESET;
+			passed = dropped;
+		}
+	}
+	close(fd);
+	std::mt19937_64 gen(6);
+	passed = passed && dropped && sorts_like_std<std::int32_t>(client, 1000, gen);
+	std::cout << "Test 6 (client not reading): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Test 7: Shutting down with clients connected, after which connecting fails
+void test_shutdown()
+{
+	auto server = std::make_unique<SortServer>(socket_path + ".2", 2);
+	bool passed = server->start();
+	auto client = SortClient::connect(socket_path + ".2");
+	std::mt19937_64 gen(5);
+	passed = passed && client && sorts_like_std<double>(*client, 5000, gen);
+	server.reset();
+	passed = passed && client && client->sort<double>(*SharedBuffer::create(64), 8) == SortStatus::TransportError;
+	passed = passed && !SortClient::connect(socket_path + ".2");
+	std::cout << "Test 7 (shutdown): " << (passed ? "Passed" : "Failed") << std::endl;
+}
+
+// Serve on socketPath until SIGINT or SIGTERM
+int serve(const std::string &socketPath, const std::size_t threads)
+{
+	// Block the signals before any thread starts so only sigwait below sees them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	SortServer server(socketPath, threads);
+	if(!server.start())
+	{
+		std::cerr << "Couldn't listen on " << socketPath << std::endl;
+		return 1;
+	}
+	std::cout << "Serving on " << socketPath << " with " << threads << " worker threads" << std::endl;
+	int received;
+	sigwait(&signals, &received);
+	server.stop();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 2 && std::strcmp(argv[1], "--serve") == 0)
+	{
+		const std::size_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+		return serve(argv[2], threads);
+	}
+
+	std::cout << "Sort server tests started" << std::endl;
+	SortServer server(socket_path, 4);
+	auto client = server.start() ? SortClient::connect(socket_path) : std::nullopt;
+	if(!client)
+	{
+		std::cout << "Couldn't start the server on " << socket_path << std::endl;
+		return 1;
+	}
+
+	test_sort(*client);
+	test_search(*client);
+	test_bad_requests(*client);
+	test_concurrent_clients();
+	test_buffer_changed_during_sort(*client);
+	test_client_not_reading(*client);
+	test_shutdown();
+
+	return 0;
+}
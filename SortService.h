@@ -0,0 +1,288 @@
+// Wire protocol and client library of the local sort/search service, see SortServer.cpp
+#ifndef SORT_SERVICE_H
+#define SORT_SERVICE_H
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests and responses travel as single SOCK_SEQPACKET messages. The data never does: every
+// request carries a memfd (SCM_RIGHTS) that the server maps and works on in place.
+enum class SortOp : std::uint32_t
+{
+	Sort, // Sort count elements at the start of the buffer in place
+	Search // Look up targetCount targets in count sorted keys, positions written back, see SearchLayout
+};
+
+enum class ElementType : std::uint32_t
+{
+	Int32,
+	Int64,
+	UInt64,
+	Double
+};
+
+enum class SortStatus : std::int32_t
+{
+	Ok,
+	BadRequest, // Unknown op or element type, or a NaN among double elements
+	BadBuffer, // No buffer, not sealed against shrinking, or smaller than the request needs
+	TransportError // Reported by the client when the socket failed, never sent by the server
+};
+
+struct SortRequest
+{
+	std::uint64_t id;
+	SortOp op;
+	ElementType type;
+	std::uint64_t count;
+	std::uint64_t targetCount;
+};
+
+struct SortResponse
+{
+	std::uint64_t id;
+	SortStatus status;
+	std::uint32_t reserved;
+	std::uint64_t hits; // Search only: targets that were found
+};
+
+template<typename T>
+constexpr ElementType elementTypeOf()
+{
+	if constexpr(std::is_same_v<T, std::int32_t>) return ElementType::Int32;
+	else if constexpr(std::is_same_v<T, std::int64_t>) return ElementType::Int64;
+	else if constexpr(std::is_same_v<T, std::uint64_t>) return ElementType::UInt64;
+	else
+	{
+		static_assert(std::is_same_v<T, double>, "the service sorts int32_t, int64_t, uint64_t and double");
+		return ElementType::Double;
+	}
+}
+
+// Where the arrays of a search request sit in its buffer: keys, then targets, then one uint64
+// position per target (what binary_search_position returned, as an index into the keys)
+template<typename T>
+struct SearchLayout
+{
+	std::size_t keyCount;
+	std::size_t targetCount;
+
+	std::size_t targetsOffset() const { return keyCount * sizeof(T); }
+	std::size_t positionsOffset() const { return (targetsOffset() + targetCount * sizeof(T) + 7) / 8 * 8; }
+	std::size_t bytes() const { return positionsOffset() + targetCount * sizeof(std::uint64_t); }
+};
+
+// Anonymous shared memory to hand to the service. Sealed against shrinking, so the server can map
+// it without a client being able to pull pages out from under it.
+class SharedBuffer
+{
+public:
+	// Empty if the memfd couldn't be created or mapped
+	static std::optional<SharedBuffer> create(const std::size_t bytes)
+	{
+		const std::size_t length = bytes ? bytes : 1;
+		const int fd = memfd_create("sort-service", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if(fd < 0)
+		{
+			return std::nullopt;
+		}
+		if(ftruncate(fd, static_cast<off_t>(length)) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0)
+		{
+			close(fd);
+			return std::nullopt;
+		}
+		void *data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(data == MAP_FAILED)
+		{
+			close(fd);
+			return std::nullopt;
+		}
+		SharedBuffer buffer;
+		buffer.memfd = fd;
+		buffer.base = data;
+		buffer.length = length;
+		return buffer;
+	}
+
+	SharedBuffer(SharedBuffer &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	SharedBuffer &operator=(SharedBuffer &&other) noexcept
+	{
+		std::swap(memfd, other.memfd);
+		std::swap(base, other.base);
+		std::swap(length, other.length);
+		return *this;
+	}
+
+	SharedBuffer(const SharedBuffer &) = delete;
+	SharedBuffer &operator=(const SharedBuffer &) = delete;
+
+	~SharedBuffer()
+	{
+		if(base)
+		{
+			munmap(base, length);
+		}
+		if(memfd >= 0)
+		{
+			close(memfd);
+		}
+	}
+
+	template<typename T>
+	T *as(const std::size_t offset = 0) const
+	{
+		return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+	}
+
+	std::size_t size() const { return length; }
+	int fd() const { return memfd; }
+
+private:
+	SharedBuffer() = default;
+
+	int memfd = -1;
+	void *base = nullptr;
+	std::size_t length = 0;
+};
+
+// Send one message with fd attached (fd < 0 sends none). MSG_NOSIGNAL so a peer that went away
+// shows up as an error instead of killing the process.
+inline bool sendWithFd(const int socket, const void *message, const std::size_t size, const int fd)
+{
+	iovec iov = {const_cast<void *>(message), size};
+	msghdr header = {};
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	if(fd >= 0)
+	{
+		header.msg_control = control;
+		header.msg_controllen = sizeof(control);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	return sendmsg(socket, &header, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+}
+
+// Connection to a running SortServer. One request is in flight at a time; callers that want
+// requests served in parallel open one client per thread.
+class SortClient
+{
+public:
+	// Empty if nothing is listening on socketPath
+	static std::optional<SortClient> connect(const std::string &socketPath)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if(socketPath.size() >= sizeof(address.sun_path))
+		{
+			return std::nullopt;
+		}
+		std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+		const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if(fd < 0)
+		{
+			return std::nullopt;
+		}
+		if(::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+		{
+			close(fd);
+			return std::nullopt;
+		}
+		SortClient client;
+		client.socketFd = fd;
+		return client;
+	}
+
+	SortClient(SortClient &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	SortClient &operator=(SortClient &&other) noexcept
+	{
+		std::swap(socketFd, other.socketFd);
+		std::swap(nextId, other.nextId);
+		return *this;
+	}
+
+	SortClient(const SortClient &) = delete;
+	SortClient &operator=(const SortClient &) = delete;
+
+	~SortClient()
+	{
+		if(socketFd >= 0)
+		{
+			close(socketFd);
+		}
+	}
+
+	// Sort the first count elements of buffer in place
+	template<typename T>
+	SortStatus sort(const SharedBuffer &buffer, const std::size_t count)
+	{
+		return call({0, SortOp::Sort, elementTypeOf<T>(), count, 0}, buffer.fd()).status;
+	}
+
+	// Search the buffer laid out as SearchLayout<T>{keyCount, targetCount}; keys must be sorted.
+	// hits, if given, receives the number of targets found.
+	template<typename T>
+	SortStatus search(const SharedBuffer &buffer, const std::size_t keyCount, const std::size_t targetCount, std::size_t *hits = nullptr)
+	{
+		const auto response = call({0, SortOp::Search, elementTypeOf<T>(), keyCount, targetCount}, buffer.fd());
+		if(hits)
+		{
+			*hits = static_cast<std::size_t>(response.hits);
+		}
+		return response.status;
+	}
+
+	// Send request with the buffer fd attached and wait for its response. Fills in the request id.
+	SortResponse call(SortRequest request, const int bufferFd)
+	{
+		request.id = nextId++;
+		SortResponse response = {request.id, SortStatus::TransportError, 0, 0};
+		if(!sendWithFd(socketFd, &request, sizeof(request), bufferFd))
+		{
+			return response;
+		}
+		SortResponse received;
+		ssize_t got;
+		do
+		{
+			got = recv(socketFd, &received, sizeof(received), 0);
+		} while(got < 0 && errno == EINTR);
+		if(got != static_cast<ssize_t>(sizeof(received)) || received.id != request.id)
+		{
+			return response;
+		}
+		return received;
+	}
+
+private:
+	SortClient() = default;
+
+	int socketFd = -1;
+	std::uint64_t nextId = 1;
+};
+
+#endif
@@ -0,0 +1,171 @@
+// Per machine, per element type thresholds for the sorting engines
+#ifndef SORT_TUNING_H
+#define SORT_TUNING_H
+
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <typeinfo>
+#include <limits>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include <mutex>
+
+// Thresholds an engine reads instead of hard coded literals. Sizes are element counts.
+struct SortTuning
+{
+	std::size_t insertionCutoff; // Ranges of at most this many elements go to the small-range base cases
+	std::size_t pivotSampleCutoff; // Ranges with more elements than this take a ninther pivot instead of median-of-3
+	std::size_t parallelCutoff; // Fewest elements worth handing to another thread
+};
+
+constexpr std::size_t neverSample = std::numeric_limits<std::size_t>::max();
+
+// Tuning entries keyed by "<engine>:<element type>", loaded from a small text cache file.
+// One line per entry: key insertionCutoff pivotSampleCutoff parallelCutoff
+// The file is read when instance() is first called, which is normally the first sort in the process,
+// so that sort also pays for opening the file (relative to the working directory unless
+// SORT_TUNING_CACHE says otherwise). Programs that mind call instance() themselves at startup.
+class SortTuningCache
+{
+public:
+	explicit SortTuningCache(std::string cachePath) : path(std::move(cachePath))
+	{
+		std::ifstream in(path);
+		std::string line;
+		while(std::getline(in, line))
+		{
+			if(line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+			std::istringstream fields(line);
+			std::string key;
+			SortTuning tuning;
+			if(fields >> key >> tuning.insertionCutoff >> tuning.pivotSampleCutoff >> tuning.parallelCutoff)
+			{
+				tuning.insertionCutoff = std::max<std::size_t>(tuning.insertionCutoff, 3); // Base cases need at least 3
+				tuning.pivotSampleCutoff = std::max<std::size_t>(tuning.pivotSampleCutoff, 16); // Ninther needs 9 spread out samples
+				entries[key] = tuning;
+			}
+		}
+	}
+
+	// Cache shared by the whole program, SORT_TUNING_CACHE overrides the default file name
+	static SortTuningCache &instance()
+	{
+		static SortTuningCache cache([]
+		{
+			const char *env = std::getenv("SORT_TUNING_CACHE");
+			return std::string(env ? env : "sort_tuning.cache");
+		}());
+		return cache;
+	}
+
+	// Entry for key, created from defaults if the cache file didn't have one. References stay valid.
+	// Safe to call from several threads; first uses of different Engine/T pairs can happen at once.
+	SortTuning &entry(const std::string &key, const SortTuning &defaults)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.emplace(key, defaults).first->second;
+	}
+
+	// Write every entry back to the cache file, returns false if the file couldn't be written
+	bool save() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::ofstream out(path);
+		out << "# key insertionCutoff pivotSampleCutoff parallelCutoff\n";
+		for(const auto &e : entries)
+		{
+			out << e.first << ' ' << e.second.insertionCutoff << ' ' << e.second.pivotSampleCutoff << ' ' << e.second.parallelCutoff << '\n';
+		}
+		return static_cast<bool>(out);
+	}
+
+private:
+	std::string path;
+	std::map<std::string, SortTuning> entries;
+	mutable std::mutex mutex;
+};
+
+// Thresholds for Engine sorting elements of type T. Engine provides a name and its defaults.
+// The lookup happens once per Engine/T pair, after that it's a plain reference. The very first
+// lookup in the process loads the cache file, see SortTuningCache.
+template<typename Engine, typename T>
+SortTuning &sortTuning()
+{
+	static SortTuning &tuning = SortTuningCache::instance().entry(std::string(Engine::name) + ":" + typeid(T).name(), Engine::defaults());
+	return tuning;
+}
+
+// Fastest of a few runs, to keep noise from other processes out of the comparison
+template<typename Benchmark>
+double bestTime(Benchmark &benchmark)
+{
+	double best = std::numeric_limits<double>::max();
+	for(int run = 0; run < 3; run++)
+	{
+		best = std::min(best, benchmark());
+	}
+	return best;
+}
+
+// Try each candidate for one threshold, keeping it only if it beats the current best by 2%
+template<typename Benchmark>
+void tuneField(std::size_t &field, const std::vector<std::size_t> &candidates, Benchmark &benchmark, double &best)
+{
+	for(const auto candidate : candidates)
+	{
+		const auto previous = field;
+		field = candidate;
+		const auto time = bestTime(benchmark);
+		if(time < best * 0.98)
+		{
+			best = time;
+		}
+		else
+		{
+			field = previous;
+		}
+	}
+}
+
+// Which thresholds an engine actually reads, autoTune leaves the others alone
+enum TunedFields : unsigned
+{
+	tuneInsertion = 1,
+	tunePivotSample = 2,
+	tuneParallel = 4
+};
+
+// Micro-benchmark the thresholds of Engine for element type T on this machine and store the
+// winners in the cache file. benchmark() runs the engine once and returns its time in seconds;
+// it sees each candidate through sortTuning<Engine, T>(), so nothing else may sort with this
+// Engine/T pair while tuning runs.
+template<typename Engine, typename T, typename Benchmark>
+SortTuning autoTune(Benchmark benchmark, const unsigned fields)
+{
+	SortTuning &tuning = sortTuning<Engine, T>();
+	double best = bestTime(benchmark);
+	if(fields & tuneInsertion)
+	{
+		tuneField(tuning.insertionCutoff, {4, 6, 8, 11, 16, 24, 32, 48}, benchmark, best);
+	}
+	if(fields & tunePivotSample)
+	{
+		tuneField(tuning.pivotSampleCutoff, {neverSample, 4096, 512, 64}, benchmark, best);
+	}
+	if(fields & tuneParallel)
+	{
+		tuneField(tuning.parallelCutoff, {16384, 65536, 262144, 1048576}, benchmark, best);
+	}
+	SortTuningCache::instance().save();
+	return tuning;
+}
+
+#endif